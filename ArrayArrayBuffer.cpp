@@ -1,86 +1,257 @@
 #include "ArrayArrayBuffer.h"
 
-#include <fstream>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include "FileLoader.h"
+#include "Trace.h"
 #include "Utils.h"
 
+// Edited lines are copied into slabs of this size, so that there is one
+// allocation for many lines. Longer lines get a slab of their own.
+const size_t SLAB_SIZE = 64 << 10;
+// Space reserved for a line when it first grows, so that typing into a
+// short line doesn't move it on every char
+const size_t MIN_CAPACITY = 16;
+// Lines are only compacted once this much space has been freed
+const size_t MIN_COMPACT_BYTES = 1 << 20;
+
+// Like memmove, but also fine with the null text of an empty line
+static void moveChars(char* to, const char* from, size_t n) {
+    if (n > 0)
+        memmove(to, from, n);
+}
+
 ArrayArrayBuffer::ArrayArrayBuffer(char* filename) {
     this->filename = filename;
 
-    // Open file for reading
-    std::ifstream fileStream(filename);
-    // If such file exists, read it in. If not, is a new file
-    if (fileStream.is_open()) {
-        // Read file line by line and insert into array in memory.
-        std::string line;
-        while (getline(fileStream, line)) {
-            // Remove carriage returns. tekst uses LF, not CRLF, for simplicity.
-            if (line.back() == '\r')
-                line.pop_back();
-            line.push_back('\n'); // getline() removes original \n
-            fileMemory.push_back(line);
-        }
-        fileMemory.push_back(""); // Should always be an empty editable line, even if no newlines
+    // Read whole file (if it exists), with carriage returns removed.
+    // The last line is always the empty editable one after the final newline.
+    LoadedFile file = loadFile(filename);
+    const std::vector<size_t>& lineLengths = file.lineLengths;
 
-        fileStream.close();
+    // Lines point into the loaded text, so loading doesn't copy it
+    loadedText = std::move(file.text);
+    pooledBytes = loadedText.length();
+    fileMemory.resize(lineLengths.size());
+    size_t offset = 0;
+    for (size_t line = 0; line < lineLengths.size(); line++) {
+        if (lineLengths[line] > UINT32_MAX)
+            throw std::string("Lines longer than 4 GB are not supported: ") + filename;
+        fileMemory[line] = {loadedText.data() + offset, (uint32_t) lineLengths[line], (uint32_t) lineLengths[line]};
+        offset += lineLengths[line];
     }
 }
 
 std::optional<std::string> ArrayArrayBuffer::getLine(uint lineNum) {
     if (lineNum < fileMemory.size())
-        return fileMemory[lineNum];
+        return std::string(fileMemory[lineNum].view());
     else
         return {};
 }
 
-// Writes to file from string in memory
-void ArrayArrayBuffer::save() {
-    std::ofstream fileStream(filename, std::ofstream::trunc);
-    if (!fileStream.is_open()) {
-        throw std::string("Unable to write to file: ") + filename;
-    }
-    for (int i = 0; i < fileMemory.size(); i++) {
-        fileStream << fileMemory[i];
-    }
-    fileStream.close();
+uint ArrayArrayBuffer::visitLines(uint firstLine, uint count, const LineVisitor& visitor) {
+    uint visited = 0;
+    for (uint line = firstLine; visited < count && line < fileMemory.size(); line++, visited++)
+        visitor(line, fileMemory[line].view());
+    return visited;
+}
+
+uint ArrayArrayBuffer::lineCount() {
+    return fileMemory.size();
+}
+
+// Copies all lines into one contiguous string
+std::unique_ptr<Snapshot> ArrayArrayBuffer::snapshot() {
+    size_t length = 0;
+    for (const Line& line : fileMemory)
+        length += line.length;
+    auto text = std::make_shared<std::string>();
+    text->reserve(length);
+    for (const Line& line : fileMemory)
+        text->append(line.view());
+    auto snapshot = std::make_unique<Snapshot>();
+    snapshot->pieces.push_back(*text);
+    snapshot->owned.push_back(text);
+    return snapshot;
 }
 
-void ArrayArrayBuffer::delChar(int line, int col) {
+void ArrayArrayBuffer::applyDelChar(int line, int col) {
     // No effect if out of range
-    if (line >= fileMemory.size() || col >= fileMemory[line].length())
+    if (line >= fileMemory.size() || col >= fileMemory[line].length)
         return;
+    Line& current = fileMemory[line];
     // Check whether char to delete is a newline
-    if (fileMemory[line][col] == '\n') {
-        // Get next line, if it exists
-        std::string nextLine = "";
-        if (line + 1 < fileMemory.size())
-            nextLine = fileMemory[line + 1];
-        // Delete the newline char
-        fileMemory[line].erase(col, 1);
-        // Append next line into current line
-        fileMemory[line].append(nextLine);
-        // Delete next line
-        fileMemory.erase(fileMemory.begin() + line + 1);
+    if (current.text[col] == '\n' && line + 1 < fileMemory.size()) {
+        // Replace the newline char with the next line, and delete that line
+        const Line& next = fileMemory[line + 1];
+        reserve(current, col + next.length);
+        moveChars(current.text + col, next.text, next.length);
+        current.length = col + next.length;
+        eraseLines(line + 1, line + 2);
     } else {
         // Delete single character at given position
-        fileMemory[line].erase(col, 1);
+        moveChars(current.text + col, current.text + col + 1, current.length - col - 1);
+        current.length--;
     }
+    compactIfWasteful();
 }
 
-void ArrayArrayBuffer::insertChar(char c, int line, int col) {
+void ArrayArrayBuffer::applyInsertChar(char c, int line, int col) {
     // No effect if out of range
-    if (line >= fileMemory.size() || col > fileMemory[line].length())
+    if (line >= fileMemory.size() || col > fileMemory[line].length)
         return;
+    Line& current = fileMemory[line];
     // Check whether char to insert is a newline
     if (c == '\n') {
-        // Get rest of line after newline character positoin
-        std::string restOfLine = fileMemory[line].substr(col, std::string::npos);
-        // Delete rest of line and add newline char
-        fileMemory[line].erase(col, std::string::npos);
-        fileMemory[line].push_back('\n');
-        // Insert new line
+        // Move rest of line after newline character position into a new line
+        Line restOfLine = makeLine(current.view().substr(col), "");
+        reserve(current, col + 1);
+        current.text[col] = '\n';
+        current.length = col + 1;
         fileMemory.insert(fileMemory.begin() + line + 1, restOfLine);
     } else {
         // Insert character, shifting everything afterwards
-        fileMemory[line].insert(fileMemory[line].begin() + col, c);
+        reserve(current, current.length + 1);
+        moveChars(current.text + col + 1, current.text + col, current.length - col);
+        current.text[col] = c;
+        current.length++;
+    }
+    compactIfWasteful();
+}
+
+void ArrayArrayBuffer::applyInsertText(int line, int col, std::string_view text) {
+    // No effect if out of range
+    if (line < 0 || col < 0 || line >= fileMemory.size())
+        return;
+    Line& first = fileMemory[line];
+    if (col > getCleanStrLen(first.view()))
+        return;
+    size_t lf = text.find('\n');
+    if (lf == std::string::npos) {
+        reserve(first, first.length + text.length());
+        moveChars(first.text + col + text.length(), first.text + col, first.length - col);
+        moveChars(first.text + col, text.data(), text.length());
+        first.length += text.length();
+        compactIfWasteful();
+        return;
+    }
+    // Split text into lines. The line is cut at the insertion point, and
+    // the rest of it goes at the end of the last inserted line.
+    std::vector<Line> added;
+    size_t start = lf + 1;
+    size_t next;
+    while ((next = text.find('\n', start)) != std::string::npos) {
+        added.push_back(makeLine(text.substr(start, next + 1 - start), ""));
+        start = next + 1;
+    }
+    added.push_back(makeLine(text.substr(start), first.view().substr(col)));
+    reserve(first, col + lf + 1);
+    moveChars(first.text + col, text.data(), lf + 1);
+    first.length = col + lf + 1;
+    // Insert new lines all at once, shifting the lines afterwards only once
+    fileMemory.insert(fileMemory.begin() + line + 1, added.begin(), added.end());
+    compactIfWasteful();
+}
+
+void ArrayArrayBuffer::applyDeleteRange(int line, int col, size_t count) {
+    // No effect if out of range
+    if (line < 0 || col < 0 || line >= fileMemory.size() || col >= fileMemory[line].length)
+        return;
+    // Find the line and column where the deleted text ends
+    size_t endLine = line;
+    size_t endCol = col + count;
+    while (endLine + 1 < fileMemory.size() && endCol >= fileMemory[endLine].length) {
+        endCol -= fileMemory[endLine].length;
+        endLine++;
+    }
+    endCol = std::min(endCol, (size_t) fileMemory[endLine].length);
+    Line& first = fileMemory[line];
+    if (endLine == line) {
+        moveChars(first.text + col, first.text + endCol, first.length - endCol);
+        first.length -= endCol - col;
+        return;
+    }
+    // Join the start of the first line with the end of the last one
+    const Line& last = fileMemory[endLine];
+    size_t rest = last.length - endCol;
+    reserve(first, col + rest);
+    moveChars(first.text + col, last.text + endCol, rest);
+    first.length = col + rest;
+    eraseLines(line + 1, endLine + 1);
+    compactIfWasteful();
+}
+
+char* ArrayArrayBuffer::allocate(size_t length) {
+    pooledBytes += length;
+    if (length > slabLeft) {
+        // Taking a new slab for a long line would waste the rest of this one
+        if (length > SLAB_SIZE / 4) {
+            slabs.emplace_back(new char[length]);
+            return slabs.back().get();
+        }
+        slabs.emplace_back(new char[SLAB_SIZE]);
+        slabFree = slabs.back().get();
+        slabLeft = SLAB_SIZE;
+    }
+    char* text = slabFree;
+    slabFree += length;
+    slabLeft -= length;
+    return text;
+}
+
+void ArrayArrayBuffer::reserve(Line& line, size_t length) {
+    if (length <= line.capacity)
+        return;
+    if (length > UINT32_MAX)
+        throw std::string("Lines longer than 4 GB are not supported");
+    // Grow by half again, so that a line growing a char at a time moves
+    // a logarithmic number of times
+    size_t capacity = std::min((size_t) UINT32_MAX, std::max(length + length / 2, MIN_CAPACITY));
+    char* text = allocate(capacity);
+    moveChars(text, line.text, line.length);
+    freedBytes += line.capacity;
+    line.text = text;
+    line.capacity = capacity;
+}
+
+ArrayArrayBuffer::Line ArrayArrayBuffer::makeLine(std::string_view first, std::string_view second) {
+    size_t length = first.length() + second.length();
+    if (length > UINT32_MAX)
+        throw std::string("Lines longer than 4 GB are not supported");
+    char* text = allocate(length);
+    moveChars(text, first.data(), first.length());
+    moveChars(text + first.length(), second.data(), second.length());
+    return {text, (uint32_t) length, (uint32_t) length};
+}
+
+void ArrayArrayBuffer::eraseLines(size_t first, size_t last) {
+    for (size_t line = first; line < last; line++)
+        freedBytes += fileMemory[line].capacity;
+    fileMemory.erase(fileMemory.begin() + first, fileMemory.begin() + last);
+}
+
+void ArrayArrayBuffer::compactIfWasteful() {
+    if (freedBytes < MIN_COMPACT_BYTES || freedBytes < pooledBytes - freedBytes)
+        return;
+    size_t length = 0;
+    for (const Line& line : fileMemory)
+        length += line.length;
+    trace("ArrayArrayBuffer | Compacting %zu bytes of lines, freeing %zu bytes", length, pooledBytes - length);
+    // Copy every line into one slab, with no space to spare
+    std::unique_ptr<char[]> slab(new char[length]);
+    char* text = slab.get();
+    for (Line& line : fileMemory) {
+        moveChars(text, line.text, line.length);
+        line.text = text;
+        line.capacity = line.length;
+        text += line.length;
     }
+    loadedText = std::string();
+    slabs.clear();
+    slabs.push_back(std::move(slab));
+    slabFree = nullptr;
+    slabLeft = 0;
+    pooledBytes = length;
+    freedBytes = 0;
 }
\ No newline at end of file
@@ -1,10 +1,15 @@
 /*
  * ArrayArrayBuffer is the second most simple text buffer implementation,
  * in which data is stored as an array of lines / strings.
+ * Lines are compact records pointing into pooled memory rather than strings
+ * of their own: loaded lines point into the file's text, and a line is only
+ * copied into a slab of edited lines once it grows past its space.
  */
 
 #pragma once
 
+#include <cstdint>
+#include <memory>
 #include <vector>
 #include "Buffer.h"
 
@@ -12,10 +17,47 @@ class ArrayArrayBuffer : public Buffer {
     public:
         ArrayArrayBuffer(char* filename);
         std::optional<std::string> getLine(uint lineNum);
-        void save();
-        void delChar(int line, int col);
-        void insertChar(char c, int line, int col);
+        uint visitLines(uint firstLine, uint count, const LineVisitor& visitor);
+        uint lineCount();
+        std::unique_ptr<Snapshot> snapshot();
+    protected:
+        void applyDelChar(int line, int col);
+        void applyInsertChar(char c, int line, int col);
+        void applyInsertText(int line, int col, std::string_view text);
+        void applyDeleteRange(int line, int col, size_t count);
     private:
-        // ArrayArrayBuffer stores the text as an array of strings (managed 2D array)
-        std::vector<std::string> fileMemory;
-};
\ No newline at end of file
+        // A line's text and the space reserved for it, which it can be
+        // edited within without moving
+        struct Line {
+            char* text;
+            uint32_t length;
+            uint32_t capacity;
+            std::string_view view() const { return std::string_view(text, length); }
+        };
+
+        // ArrayArrayBuffer stores the text as an array of lines (managed 2D array)
+        std::vector<Line> fileMemory;
+        // Text of the file as loaded, which the lines point into until edited
+        std::string loadedText;
+        // Slabs that edited lines are copied into, the last one being filled
+        std::vector<std::unique_ptr<char[]>> slabs;
+        char* slabFree = nullptr;
+        size_t slabLeft = 0;
+        // Bytes of loadedText and slabs handed out, and how many of them
+        // belong to lines that moved or were deleted since
+        size_t pooledBytes = 0;
+        size_t freedBytes = 0;
+
+        // Takes space for `length` chars from the slabs
+        char* allocate(size_t length);
+        // Makes room for a line to grow to `length` chars, moving it into
+        // new space (with some to spare) if it doesn't fit in its own
+        void reserve(Line& line, size_t length);
+        // Creates a line holding the concatenation of two texts
+        Line makeLine(std::string_view first, std::string_view second);
+        // Removes lines in [first, last), freeing their space
+        void eraseLines(size_t first, size_t last);
+        // Copies all lines into new slabs once more space is freed than
+        // used, letting go of the old ones
+        void compactIfWasteful();
+};
@@ -1,92 +1,80 @@
 #include "ArrayBuffer.h"
 
-#include <fstream>
-#include "Utils.h"
+#include <algorithm>
+#include "FileLoader.h"
+#include "Trace.h"
 
 ArrayBuffer::ArrayBuffer(char* filename) {
     this->filename = filename;
 
-    // Open file for reading
-    std::ifstream fileStream(filename);
-    // If such file exists, read it in. If not, is a new file
-    if (fileStream.is_open()) {
-        // Seek to EOF to get length
-        fileStream.seekg(0, std::ios::end);
-        int length = fileStream.tellg();
-        fileStream.seekg(0, std::ios::beg);
-        debugLog << "ArrayBuffer | Length is " << length << " bytes, allocating 2x capacity" << std::endl;
-
-        // Contiguous array capacity initially twice file length so that
-        // array doesn't immediately have to be copied after some insertions.
-        // This will be unmanageably large for huge files.
-        fileMemory.reserve(length * 2);
-
-        // Read file line by line and append to array in memory.
-        std::string line;
-        while (getline(fileStream, line)) {
-            // Remove carriage returns. tekst uses LF, not CRLF, for simplicity.
-            if (line.back() == '\r')
-                line.pop_back();
-            fileMemory.insert(fileMemory.end(), line.begin(), line.end());
-            fileMemory.push_back('\n'); // getline() removes original \n
-        }
-
-        fileStream.close();
-    }
+    // Read whole file (if it exists) straight into the array in memory.
+    // The loader removes carriage returns and finds line lengths for the index.
+    LoadedFile file = loadFile(filename);
+    fileMemory = std::move(file.text);
+    lineIndex.build(std::move(file.lineLengths));
+    trace("ArrayBuffer | Length is %zu bytes", fileMemory.length());
 }
 
 // Gets the start and end indices of a given line in the contiguous string,
-// by counting delimiters.
+// from the line index. End is the index of the line's delimiter, or npos if
+// it is the last line. Begin is npos if there is no such line.
 void ArrayBuffer::getLineBounds(uint lineNum, size_t* beginP, size_t* endP) {
-    uint lineCount = 0;
-    size_t begin = 0;
-    size_t end = 0;
-
-    do {
-        // If not first iteration, move `begin` pos to char after delimiter
-        begin = lineCount > 0 ? end + 1 : 0;
-        // Search for the next delimiter starting from `begin`
-        end = fileMemory.find('\n', begin);
-        // No more delimiters
-        if (end == std::string::npos) {
-            // If desired line was after current line (from `begin` to npos),
-            // no such line. Set begin to npos as a flag.
-            if (lineCount < lineNum) {
-                begin = std::string::npos;
-            }
-            break;
-        }
-    } while (lineCount++ < lineNum);
-
-    *beginP = begin;
-    *endP = end;
+    if (lineNum >= lineIndex.lineCount()) {
+        *beginP = std::string::npos;
+        *endP = std::string::npos;
+        return;
+    }
+    *beginP = lineIndex.lineStart(lineNum);
+    if (lineNum + 1 < lineIndex.lineCount())
+        *endP = *beginP + lineIndex.lineLength(lineNum) - 1;
+    else
+        *endP = std::string::npos;
 }
 
 std::optional<std::string> ArrayBuffer::getLine(uint lineNum) {
     // Get n-th line from text file's representation in memory.
-    // Since stored as a contiguous array, have to count delimiters
-    // which is inefficient but is an intrinsic weakness of this naive
-    // buffer implementation. Natural next step is array of arrays implementation.
+    // Since stored as a contiguous array, line positions come from
+    // the line index which is maintained alongside the array.
 
     size_t begin, end;
     getLineBounds(lineNum, &begin, &end);
     if (begin == std::string::npos)
         return {};
+    else if (end == std::string::npos)
+        return fileMemory.substr(begin);
     else
         return fileMemory.substr(begin, end - begin + 1);
 }
 
-// Writes to file from string in memory
-void ArrayBuffer::save() {
-    std::ofstream fileStream(filename, std::ofstream::trunc);
-    if (!fileStream.is_open()) {
-        throw std::string("Unable to write to file: ") + filename;
+uint ArrayBuffer::visitLines(uint firstLine, uint count, const LineVisitor& visitor) {
+    if (firstLine >= lineIndex.lineCount())
+        return 0;
+    // Lines are consecutive in memory, so only the first needs a lookup
+    std::string_view text = fileMemory;
+    size_t begin = lineIndex.lineStart(firstLine);
+    uint visited = 0;
+    for (uint line = firstLine; visited < count && line < lineIndex.lineCount(); line++, visited++) {
+        size_t length = lineIndex.lineLength(line);
+        visitor(line, text.substr(begin, length));
+        begin += length;
     }
-    fileStream << fileMemory;
-    fileStream.close();
+    return visited;
+}
+
+uint ArrayBuffer::lineCount() {
+    return lineIndex.lineCount();
 }
 
-void ArrayBuffer::delChar(int line, int col) {
+// Copies the string in memory
+std::unique_ptr<Snapshot> ArrayBuffer::snapshot() {
+    auto text = std::make_shared<const std::string>(fileMemory);
+    auto snapshot = std::make_unique<Snapshot>();
+    snapshot->pieces.push_back(*text);
+    snapshot->owned.push_back(text);
+    return snapshot;
+}
+
+void ArrayBuffer::applyDelChar(int line, int col) {
     // Get bound indices of line to edit
     size_t begin, end;
     getLineBounds(line, &begin, &end);
@@ -94,11 +82,16 @@ void ArrayBuffer::delChar(int line, int col) {
     if (col > end - begin || begin + col >= fileMemory.length())
         return;
     size_t charPos = begin + col;
+    // Deleting a delimiter joins the line with the next one
+    if (fileMemory[charPos] == '\n')
+        lineIndex.joinLines(line);
+    else
+        lineIndex.adjustLine(line, -1);
     // Delete single character at given position
     fileMemory.erase(charPos, 1);
 }
 
-void ArrayBuffer::insertChar(char c, int line, int col) {
+void ArrayBuffer::applyInsertChar(char c, int line, int col) {
     // Get bound indices of line to edit
     size_t begin, end;
     getLineBounds(line, &begin, &end);
@@ -107,4 +100,33 @@ void ArrayBuffer::insertChar(char c, int line, int col) {
         return;
     // Insert character, shifting everything afterwards
     fileMemory.insert(fileMemory.begin() + begin + col, c);
+    if (c == '\n')
+        lineIndex.splitLine(line, col);
+    else
+        lineIndex.adjustLine(line, 1);
+}
+
+void ArrayBuffer::applyInsertText(int line, int col, std::string_view text) {
+    // Get bound indices of line to edit
+    size_t begin, end;
+    getLineBounds(line, &begin, &end);
+    // No effect if out of range
+    if (begin == std::string::npos || col < 0 || col > end - begin || begin + col > fileMemory.length())
+        return;
+    // Insert all the text with a single shift of everything afterwards
+    fileMemory.insert(begin + col, text);
+    lineIndex.insertText(line, col, text);
+}
+
+void ArrayBuffer::applyDeleteRange(int line, int col, size_t count) {
+    // Get bound indices of line to edit
+    size_t begin, end;
+    getLineBounds(line, &begin, &end);
+    // No effect if out of range
+    if (begin == std::string::npos || col < 0 || col > end - begin || begin + col >= fileMemory.length())
+        return;
+    size_t charPos = begin + col;
+    count = std::min(count, fileMemory.length() - charPos);
+    lineIndex.deleteText(line, col, count);
+    fileMemory.erase(charPos, count);
 }
\ No newline at end of file
@@ -7,18 +7,26 @@
 
 #include <vector>
 #include "Buffer.h"
+#include "LineIndex.h"
 
 class ArrayBuffer : public Buffer {
     public:
         ArrayBuffer(char* filename);
         std::optional<std::string> getLine(uint lineNum);
-        void save();
-        void delChar(int line, int col);
-        void insertChar(char c, int line, int col);
+        uint visitLines(uint firstLine, uint count, const LineVisitor& visitor);
+        uint lineCount();
+        std::unique_ptr<Snapshot> snapshot();
+    protected:
+        void applyDelChar(int line, int col);
+        void applyInsertChar(char c, int line, int col);
+        void applyInsertText(int line, int col, std::string_view text);
+        void applyDeleteRange(int line, int col, size_t count);
     private:
         // ArrayBuffer stores all the text as a managed array / vector / ArrayList / std::string
         std::string fileMemory;
+        // Start offsets of lines in fileMemory, kept up to date on edits
+        LineIndex lineIndex;
         // Gets the start and end indices of a given line in the contiguous string,
-        // by counting delimiters.
+        // from the line index.
         void getLineBounds(uint lineNum, size_t* beginP, size_t* endP);
 };
\ No newline at end of file
@@ -1,9 +1,19 @@
 #include "Buffer.h"
 
+#include <algorithm>
 #include "ArrayArrayBuffer.h"
 #include "ArrayBuffer.h"
+#include "Compression.h"
+#include "FileLoader.h"
+#include "FileSaver.h"
+#include "GapBuffer.h"
+#include "PagedBuffer.h"
+#include "PieceTableBuffer.h"
+#include "RopeBuffer.h"
+#include "Trace.h"
 
-std::unique_ptr<Buffer> Buffer::createBuffer(BufferType type, char* filename) {
+std::unique_ptr<Buffer> Buffer::createBuffer(BufferType type, char* filename, bool followed) {
+    TraceTimer timer(TraceOp::Load);
     switch (type) {
         case BufferType::ArrayBufferType:
             return std::make_unique<ArrayBuffer>(filename);
@@ -11,22 +21,254 @@ std::unique_ptr<Buffer> Buffer::createBuffer(BufferType type, char* filename) {
         case BufferType::ArrayArrayBufferType:
             return std::make_unique<ArrayArrayBuffer>(filename);
             break;
+        case BufferType::PieceTableBufferType:
+            return std::make_unique<PieceTableBuffer>(filename, !followed);
+            break;
+        case BufferType::RopeBufferType:
+            return std::make_unique<RopeBuffer>(filename);
+            break;
+        case BufferType::GapBufferType:
+            return std::make_unique<GapBuffer>(filename);
+            break;
+        case BufferType::PagedBufferType:
+            return std::make_unique<PagedBuffer>(filename, !followed);
+            break;
         // No default case so that type enum and switch statement synchronization
         // checked by compiler.
     }
 }
 
+size_t Snapshot::size() const {
+    size_t size = 0;
+    for (size_t i = 0; i < pieces.size(); i++)
+        size += pieceLength(i);
+    return size;
+}
+
+size_t Snapshot::pieceLength(size_t i) const {
+    if (packed.empty() || !packed[i].blockLength)
+        return pieces[i].length();
+    return packed[i].length;
+}
+
+std::string_view Snapshot::readPiece(size_t i, std::string& scratch) const {
+    if (packed.empty() || !packed[i].blockLength)
+        return pieces[i];
+    decompressBlock(pieces[i], packed[i].blockLength, scratch);
+    return std::string_view(scratch).substr(packed[i].offset, packed[i].length);
+}
+
+void Buffer::save() {
+    writeSnapshot(*snapshot(), filename, nullptr);
+}
+
+uint Buffer::visitLineSlices(uint firstLine, uint count, size_t fromCol, size_t width, const SliceVisitor& visitor) {
+    return visitLines(firstLine, count, [&](uint lineNum, std::string_view line) {
+        bool hasNewline = !line.empty() && line.back() == '\n';
+        if (hasNewline)
+            line.remove_suffix(1);
+        std::string_view text = fromCol < line.length() ? line.substr(fromCol, width) : std::string_view();
+        visitor(lineNum, {text, line.length(), hasNewline});
+    });
+}
+
+// Only the char at the position is visited, so checking a position in a
+// long line doesn't copy all of it
+bool Buffer::isValidPosition(int line, int col, bool needChar) {
+    if (isReadOnly() || line < 0 || col < 0)
+        return false;
+    bool valid = false;
+    visitLineSlices(line, 1, col, 1, [&](uint, const LineSlice& slice) {
+        valid = (size_t) col <= slice.length && (!needChar || (size_t) col < slice.length + slice.hasNewline);
+    });
+    return valid;
+}
+
+void Buffer::delChar(int line, int col) {
+    TraceTimer timer(TraceOp::DelChar);
+    if (!isValidPosition(line, col, true))
+        return;
+    char c;
+    visitLineSlices(line, 1, col, 1, [&](uint, const LineSlice& slice) {
+        c = slice.text.empty() ? '\n' : slice.text[0];
+    });
+    history.recordDelete(line, col, std::string_view(&c, 1), true);
+    applyDelChar(line, col);
+    notifyEdit(line, col, std::string_view(&c, 1), "");
+}
+
+void Buffer::insertChar(char c, int line, int col) {
+    TraceTimer timer(TraceOp::InsertChar);
+    if (!isValidPosition(line, col, false))
+        return;
+    history.recordInsert(line, col, std::string_view(&c, 1), true);
+    applyInsertChar(c, line, col);
+    notifyEdit(line, col, "", std::string_view(&c, 1));
+}
+
+void Buffer::insertText(int line, int col, std::string_view text, bool typing) {
+    if (text.empty() || !isValidPosition(line, col, false))
+        return;
+    history.recordInsert(line, col, text, typing);
+    applyInsertText(line, col, text);
+    notifyEdit(line, col, "", text);
+}
+
+void Buffer::deleteRange(int line, int col, size_t count, bool typing) {
+    if (count == 0 || !isValidPosition(line, col, true))
+        return;
+    // Copy the text being deleted, visiting more lines each time so that
+    // short ranges don't visit many lines and long ones don't take many calls
+    deletedScratch.clear();
+    size_t skip = col;
+    uint nextLine = line;
+    for (uint batch = 16; deletedScratch.length() < count; batch *= 2) {
+        uint visited = visitLines(nextLine, batch, [&](uint, std::string_view text) {
+            if (deletedScratch.length() >= count)
+                return;
+            text.remove_prefix(std::min(skip, text.length()));
+            skip = 0;
+            deletedScratch.append(text.substr(0, count - deletedScratch.length()));
+        });
+        if (visited < batch)
+            break;
+        nextLine += visited;
+    }
+    if (deletedScratch.empty())
+        return;
+    history.recordDelete(line, col, deletedScratch, typing);
+    applyDeleteRange(line, col, deletedScratch.length());
+    notifyEdit(line, col, deletedScratch, "");
+}
+
+void Buffer::applyEdit(const UndoHistory::Edit& edit, bool revert) {
+    bool insert = (edit.kind == UndoHistory::Kind::Insert) != revert;
+    if (insert) {
+        applyInsertText(edit.line, edit.col, edit.text);
+        notifyEdit(edit.line, edit.col, "", edit.text);
+    } else {
+        applyDeleteRange(edit.line, edit.col, edit.text.length());
+        notifyEdit(edit.line, edit.col, edit.text, "");
+    }
+}
+
+void Buffer::addEditListener(EditListener listener) {
+    editListeners.push_back(std::move(listener));
+}
+
+void Buffer::addChangeListener(ChangeListener listener) {
+    changeListeners.push_back(std::move(listener));
+}
+
+void Buffer::notifyEdit(int line, int col, std::string_view removed, std::string_view added) {
+    for (const ChangeListener& listener : changeListeners)
+        listener(line, col, removed, added);
+    if (editListeners.empty())
+        return;
+    notifyEdit(line, std::count(removed.begin(), removed.end(), '\n'), std::count(added.begin(), added.end(), '\n'));
+}
+
+void Buffer::notifyEdit(int line, uint linesRemoved, uint linesAdded) {
+    for (const EditListener& listener : editListeners)
+        listener(line, linesRemoved, linesAdded);
+}
+
+void Buffer::appendText(std::string_view text, bool continuesLine) {
+    if (text.empty())
+        return;
+    uint lines = lineCount();
+    uint line = applyAppend(text, continuesLine);
+    notifyEdit(line, 0, lineCount() - lines);
+}
+
+uint Buffer::applyAppend(std::string_view text, bool continuesLine) {
+    // Drop the CR of CRLF line endings, like FileLoader
+    std::string converted;
+    converted.reserve(text.length());
+    for (size_t i = 0; i < text.length(); i++) {
+        if (text[i] != '\r' || i + 1 == text.length() || text[i + 1] != '\n')
+            converted.push_back(text[i]);
+    }
+    uint line = lineCount() - 1;
+    if (continuesLine && line > 0 && !converted.empty() && converted.back() == '\n') {
+        // The line feed already there ends the text's last line instead
+        line--;
+        converted.pop_back();
+    }
+    size_t length = 0;
+    visitLineSlices(line, 1, 0, 0, [&](uint, const LineSlice& slice) { length = slice.length; });
+    applyInsertText(line, length, converted);
+    return line;
+}
+
+void Buffer::reload() {
+    uint linesRemoved = lineCount() - 1;
+    applyReload();
+    history.clear();
+    notifyEdit(0, linesRemoved, lineCount() - 1);
+}
+
+void Buffer::applyReload() {
+    // Slices of no width only give the lengths of lines
+    size_t length = 0;
+    visitLineSlices(0, lineCount(), 0, 0, [&](uint, const LineSlice& slice) {
+        length += slice.length + slice.hasNewline;
+    });
+    if (length > 0)
+        applyDeleteRange(0, 0, length);
+    LoadedFile file = loadFile(filename);
+    if (!file.text.empty())
+        applyInsertText(0, 0, file.text);
+}
+
+bool Buffer::undo(int* line, int* col) {
+    UndoHistory::Edit edit;
+    if (!history.undo(&edit))
+        return false;
+    // Groups are undone from their last edit back to their first
+    applyEdit(edit, true);
+    while (edit.more && history.undo(&edit))
+        applyEdit(edit, true);
+    *line = edit.line;
+    *col = edit.col;
+    return true;
+}
+
+bool Buffer::redo(int* line, int* col) {
+    UndoHistory::Edit edit;
+    if (!history.redo(&edit))
+        return false;
+    *line = edit.line;
+    *col = edit.col;
+    applyEdit(edit, false);
+    while (edit.more && history.redo(&edit))
+        applyEdit(edit, false);
+    return true;
+}
+
 std::string Buffer::bufferTypeToString(BufferType type) {
     switch (type) {
         case BufferType::ArrayBufferType:
             return "ArrayBuffer";
         case BufferType::ArrayArrayBufferType:
             return "ArrayArrayBuffer";
+        case BufferType::PieceTableBufferType:
+            return "PieceTableBuffer";
+        case BufferType::RopeBufferType:
+            return "RopeBuffer";
+        case BufferType::GapBufferType:
+            return "GapBuffer";
+        case BufferType::PagedBufferType:
+            return "PagedBuffer";
     }
 }
 
 BufferType Buffer::bufferTypeFromString(std::string type) {
     if (type == "ArrayBuffer") return BufferType::ArrayBufferType;
     if (type == "ArrayArrayBuffer") return BufferType::ArrayArrayBufferType;
+    if (type == "PieceTableBuffer") return BufferType::PieceTableBufferType;
+    if (type == "RopeBuffer") return BufferType::RopeBufferType;
+    if (type == "GapBuffer") return BufferType::GapBufferType;
+    if (type == "PagedBuffer") return BufferType::PagedBufferType;
     return BufferType::ArrayBufferType;
 }
\ No newline at end of file
@@ -6,25 +6,164 @@
 
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <vector>
+#include "UndoHistory.h"
 
-enum BufferType { ArrayBufferType, ArrayArrayBufferType };
+enum BufferType { ArrayBufferType, ArrayArrayBufferType, PieceTableBufferType, RopeBufferType, GapBufferType, PagedBufferType };
+
+// Called by Buffer::visitLines with each line's number and text. The text
+// is a view into the buffer's memory, only valid until the callback returns.
+using LineVisitor = std::function<void(uint lineNum, std::string_view line)>;
+
+// Part of a line visited by Buffer::visitLineSlices
+struct LineSlice {
+    // Chars from the first column asked for, not including the newline.
+    // Only valid until the callback returns, like in LineVisitor.
+    std::string_view text;
+    // Length of the whole line, not including the newline
+    size_t length;
+    bool hasNewline;
+};
+using SliceVisitor = std::function<void(uint lineNum, const LineSlice& slice)>;
+
+// Called after every edit with the first line it changed, and the number of
+// lines after that one it removed and added (by deleting and inserting line feeds)
+using EditListener = std::function<void(uint line, uint linesRemoved, uint linesAdded)>;
+
+// Called after every edit made to the text (see Buffer::addChangeListener)
+// with the position it was made at, and the text it removed and added there
+using ChangeListener = std::function<void(uint line, uint col, std::string_view removed, std::string_view added)>;
+
+// Immutable copy of a buffer's text at one point in time, which can be read
+// from another thread while the buffer keeps being edited. The text is the
+// concatenation of `pieces`, which point into memory kept alive by `owned`.
+// Buffers keeping text compressed can hand out pieces that are compressed
+// blocks (see Compression.h), which are only decompressed as they are read.
+struct Snapshot {
+    // Where a compressed piece's text is in its block's text
+    struct Packed {
+        // Length of the block's text, or 0 if the piece isn't compressed
+        size_t blockLength = 0;
+        size_t offset = 0;
+        size_t length = 0;
+    };
+
+    std::vector<std::string_view> pieces;
+    std::vector<std::shared_ptr<const void>> owned;
+    // Indexed like `pieces`, or empty if no piece is compressed
+    std::vector<Packed> packed;
+    // Whether pieces point into a mapping of the file, whose text changes
+    // if the file is written in place
+    bool mapsFile = false;
+    size_t size() const;
+    size_t pieceLength(size_t i) const;
+    // Text of the i-th piece, decompressed into `scratch` if it is
+    // compressed, so only valid until `scratch` is changed
+    std::string_view readPiece(size_t i, std::string& scratch) const;
+};
 
 class Buffer {
     public:
+        virtual ~Buffer() = default;
         virtual std::optional<std::string> getLine(uint lineNum) = 0;
-        virtual void save() = 0;
-        virtual void delChar(int line, int col) = 0;
-        virtual void insertChar(char c, int line, int col) = 0;
+        // Visits up to `count` lines starting from `firstLine` without copying
+        // them, stopping at the end of the file. Returns number of lines visited.
+        virtual uint visitLines(uint firstLine, uint count, const LineVisitor& visitor) = 0;
+        // Like visitLines, but only visits up to `width` chars of each line
+        // starting from column `fromCol`, so that a very long line isn't
+        // copied to show part of it. Buffers that may copy lines while
+        // visiting them override this to only copy the slice.
+        virtual uint visitLineSlices(uint firstLine, uint count, size_t fromCol, size_t width, const SliceVisitor& visitor);
+        // Number of lines, including the last (possibly empty) one
+        virtual uint lineCount() = 0;
+        // Number of lines if it is known without waiting for a scan or
+        // reading through the text, or else 0
+        virtual uint knownLineCount() { return lineCount(); }
+        // Copies the text into a snapshot that isn't affected by later edits
+        virtual std::unique_ptr<Snapshot> snapshot() = 0;
+        // Writes a snapshot of the text to the file (see FileSaver)
+        void save();
+        // Whether the text can't be edited, in which case edits are ignored
+        virtual bool isReadOnly() const { return false; }
+        // Edits are recorded in the undo history before being applied.
+        // Edits at positions outside the text are ignored.
+        void delChar(int line, int col);
+        void insertChar(char c, int line, int col);
+        // Inserts text, which may contain newlines, at (line, col) in one edit.
+        // If `typing`, it continues the current run of typing in the undo
+        // history like insertChar does (for chars longer than a byte).
+        void insertText(int line, int col, std::string_view text, bool typing = false);
+        // Deletes `count` chars (including newlines) starting from (line, col),
+        // or up to the end of the text if there are fewer. If `typing`, it
+        // continues the current run of deleting like delChar does.
+        void deleteRange(int line, int col, size_t count, bool typing = false);
+        // Reverts the last edit (or run of typing, or group of edits), or
+        // applies the last reverted one again. Sets (line, col) to where the
+        // edit starts, and returns false if there is nothing to undo or redo.
+        bool undo(int* line, int* col);
+        bool redo(int* line, int* col);
+        // Appends text that was added to the end of the file on disk (see
+        // FileFollower), which must be whole lines. This isn't an edit by
+        // the user, so it isn't recorded in the undo history, and it is
+        // appended even if the buffer is read-only. If `continuesLine`, the
+        // file's last line had no line feed, and the text continues it.
+        void appendText(std::string_view text, bool continuesLine = false);
+        // Reads the file again after it was replaced or cut short on disk,
+        // replacing all the text and forgetting the undo history
+        void reload();
+        // Adds a listener called after every edit, including undo and redo.
+        // Edits must not be made after the listener's owner is gone.
+        void addEditListener(EditListener listener);
+        // Adds a listener called after every edit made by the methods above,
+        // including undo and redo, with the text the edit changed. Unlike
+        // edit listeners, it isn't called for appended or reloaded text,
+        // which comes from the file rather than from editing it.
+        void addChangeListener(ChangeListener listener);
 
-        // Static factory method for instantiating Buffer objects
-        static std::unique_ptr<Buffer> createBuffer(BufferType, char* filename);
+        // Static factory method for instantiating Buffer objects. A file
+        // that is `followed` (see FileFollower) can be cut short while it is
+        // open, so it is never read through a memory mapping.
+        static std::unique_ptr<Buffer> createBuffer(BufferType, char* filename, bool followed = false);
         static std::string bufferTypeToString(BufferType);
         static BufferType bufferTypeFromString(std::string);
 
         // Name of file the buffer uses.
         // Non-const because this could change in a save-as.
         std::string filename;
+        UndoHistory history;
+    protected:
+        // Implemented by each buffer to edit its text, without recording
+        // the edit. Positions have already been checked.
+        virtual void applyDelChar(int line, int col) = 0;
+        virtual void applyInsertChar(char c, int line, int col) = 0;
+        virtual void applyInsertText(int line, int col, std::string_view text) = 0;
+        virtual void applyDeleteRange(int line, int col, size_t count) = 0;
+        // Appends text to the end, returning the first line it changed. By
+        // default this converts CRLF line endings and inserts it at the end
+        // of the last line, or before the line feed FileLoader ended the
+        // line before it with if the text continues that line.
+        virtual uint applyAppend(std::string_view text, bool continuesLine);
+        // Replaces all text with the file's. By default this deletes all
+        // text and inserts what FileLoader reads from the file.
+        virtual void applyReload();
+    private:
+        // Holds text being deleted while it is recorded
+        std::string deletedScratch;
+        std::vector<EditListener> editListeners;
+        std::vector<ChangeListener> changeListeners;
+
+        // Whether (line, col) is a position in the text, and if
+        // `needChar`, whether there is a char at it. Never true if the
+        // buffer is read-only, so that edits are ignored.
+        bool isValidPosition(int line, int col, bool needChar);
+        // Applies an edit from the undo history, reverted if `revert`
+        void applyEdit(const UndoHistory::Edit& edit, bool revert);
+        // Tells listeners that `removed` text was replaced by `added` text at (line, col)
+        void notifyEdit(int line, int col, std::string_view removed, std::string_view added);
+        void notifyEdit(int line, uint linesRemoved, uint linesAdded);
 };
\ No newline at end of file
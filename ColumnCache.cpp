@@ -0,0 +1,52 @@
+#include "ColumnCache.h"
+
+#include <algorithm>
+#include "Utils.h"
+
+// Mappings kept at most, which is plenty for the lines in view. Once
+// there are more, they are all dropped rather than tracking which is oldest.
+const size_t MAX_LINES = 1024;
+
+ColumnCache::ColumnCache(Buffer* b) : buffer(b) {
+    buffer->addChangeListener([this](uint line, uint, std::string_view removed, std::string_view added) {
+        onChange(line, removed, added);
+    });
+}
+
+const LineColumns& ColumnCache::get(uint line) {
+    auto it = cache.find(line);
+    if (it != cache.end())
+        return it->second;
+    if (cache.size() >= MAX_LINES)
+        cache.clear();
+    LineColumns& columns = cache[line];
+    buffer->visitLines(line, 1, [&](uint, std::string_view text) {
+        columns = LineColumns(text.substr(0, getCleanStrLen(text)));
+    });
+    return columns;
+}
+
+void ColumnCache::onChange(uint line, std::string_view removed, std::string_view added) {
+    uint linesRemoved = std::count(removed.begin(), removed.end(), '\n');
+    uint linesAdded = std::count(added.begin(), added.end(), '\n');
+    auto it = cache.find(line);
+    if (it != cache.end()) {
+        if (linesRemoved == 0 && linesAdded == 0 && it->second.isAscii()
+                && asciiPrefix(removed) == removed.length() && asciiPrefix(added) == added.length())
+            it->second.resize(it->second.length() - removed.length() + added.length());
+        else
+            cache.erase(it);
+    }
+    if (linesRemoved == 0 && linesAdded == 0)
+        return;
+    // Lines up to the last one the edit removed changed, and the lines
+    // after them moved
+    std::unordered_map<uint, LineColumns> moved;
+    for (auto& entry : cache) {
+        if (entry.first < line)
+            moved.emplace(entry.first, std::move(entry.second));
+        else if (entry.first > line + linesRemoved)
+            moved.emplace(entry.first - linesRemoved + linesAdded, std::move(entry.second));
+    }
+    cache.swap(moved);
+}
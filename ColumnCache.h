@@ -0,0 +1,32 @@
+/*
+ * ColumnCache keeps the column mapping (see LineColumns) of the lines the
+ * editor has needed one for, like the cursor's line and ones with search
+ * matches in view, so that moving the cursor doesn't decode its line again
+ * on every key. A line's mapping is dropped when it is edited, unless ASCII
+ * text was typed into (or deleted from) an ASCII line, which only changes
+ * its length.
+ */
+
+#pragma once
+
+#include <unordered_map>
+#include "Buffer.h"
+#include "Utf8.h"
+
+class ColumnCache {
+    public:
+        ColumnCache(Buffer* b);
+        // Mapping of a line, which is read from the buffer if it isn't cached.
+        // Lines past the end of the text map as empty. The reference is only
+        // valid until the next call or edit.
+        const LineColumns& get(uint line);
+        // Forgets all mappings, for when text changed without an edit by the
+        // user (see Buffer::appendText and Buffer::reload)
+        void clear() { cache.clear(); }
+    private:
+        Buffer* buffer;
+        std::unordered_map<uint, LineColumns> cache;
+
+        // Updates the mappings after an edit (see ChangeListener)
+        void onChange(uint line, std::string_view removed, std::string_view added);
+};
@@ -0,0 +1,148 @@
+#include "Compression.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Shortest back-reference worth encoding
+const size_t MIN_MATCH = 4;
+const size_t MAX_OFFSET = 0xffff;
+// Positions of recent 4-byte sequences are kept in a table of this many
+// bits of their hash
+const int HASH_BITS = 14;
+
+// Each sequence starts with a token byte: the high 4 bits are the number of
+// literals, and the low 4 bits the match length minus MIN_MATCH. A field of 15
+// is continued in the following bytes, each added on, until one below 255.
+// The literals follow the token, then the match's 2-byte offset (little
+// endian). The last sequence only has literals.
+
+static uint32_t read32(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Copies n bytes 8 at a time, which can write up to 7 bytes past the end and
+// read up to 7 bytes past `from + n`. Fine for overlapping copies as long as
+// `to` is at least 8 bytes after `from`.
+static void copyWide(char* to, const char* from, size_t n) {
+    for (size_t k = 0; k < n; k += 8)
+        memcpy(to + k, from + k, 8);
+}
+
+static size_t hash32(uint32_t v) {
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Writes the rest of a length field that didn't fit in its token
+static void putLength(std::string& out, size_t length) {
+    for (; length >= 255; length -= 255)
+        out.push_back((char) 255);
+    out.push_back((char) length);
+}
+
+static void putSequence(std::string& out, std::string_view literals, size_t offset, size_t matchLength) {
+    size_t matchField = matchLength - MIN_MATCH;
+    out.push_back((char) ((std::min(literals.length(), (size_t) 15) << 4) | std::min(matchField, (size_t) 15)));
+    if (literals.length() >= 15)
+        putLength(out, literals.length() - 15);
+    out.append(literals);
+    out.push_back((char) (offset & 0xff));
+    out.push_back((char) (offset >> 8));
+    if (matchField >= 15)
+        putLength(out, matchField - 15);
+}
+
+std::string compressBlock(std::string_view text) {
+    std::string out;
+    out.reserve(text.length() / 2 + 16);
+    // Position + 1 of the last sequence with each hash, or 0 if none
+    std::vector<uint32_t> table(1 << HASH_BITS, 0);
+    const char* data = text.data();
+    size_t n = text.length();
+    size_t anchor = 0; // Start of literals not written yet
+    size_t i = 0;
+    while (i + MIN_MATCH <= n) {
+        size_t h = hash32(read32(data + i));
+        size_t candidate = table[h];
+        table[h] = i + 1;
+        if (candidate == 0 || i - (candidate - 1) > MAX_OFFSET || read32(data + candidate - 1) != read32(data + i)) {
+            i++;
+            continue;
+        }
+        candidate--;
+        size_t length = MIN_MATCH;
+        while (i + length < n && data[candidate + length] == data[i + length])
+            length++;
+        putSequence(out, text.substr(anchor, i - anchor), i - candidate, length);
+        i += length;
+        anchor = i;
+        // Remember a position near the end of the match, so that text
+        // repeating right after it is found too
+        if (i >= 2 && i - 2 + MIN_MATCH <= n)
+            table[hash32(read32(data + i - 2))] = i - 1;
+    }
+    // Last literals, with no match
+    size_t literals = n - anchor;
+    out.push_back((char) (std::min(literals, (size_t) 15) << 4));
+    if (literals >= 15)
+        putLength(out, literals - 15);
+    out.append(text.substr(anchor));
+    return out;
+}
+
+void decompressBlock(std::string_view packed, size_t length, std::string& out) {
+    // Room for copyWide to write past the end
+    out.resize(length + 8);
+    const unsigned char* in = (const unsigned char*) packed.data();
+    const unsigned char* inEnd = in + packed.length();
+    char* dest = &out[0];
+    size_t written = 0;
+    auto getLength = [&](size_t field) {
+        if (field < 15)
+            return field;
+        unsigned char b;
+        do {
+            if (in == inEnd)
+                throw std::string("Corrupt compressed text");
+            b = *in++;
+            field += b;
+        } while (b == 255);
+        return field;
+    };
+    while (in < inEnd) {
+        unsigned char token = *in++;
+        size_t literals = getLength(token >> 4);
+        if (literals > (size_t) (inEnd - in) || literals > length - written)
+            throw std::string("Corrupt compressed text");
+        if ((size_t) (inEnd - in) >= literals + 8)
+            copyWide(dest + written, (const char*) in, literals);
+        else
+            memcpy(dest + written, in, literals);
+        in += literals;
+        written += literals;
+        if (in == inEnd)
+            break;
+        if (inEnd - in < 2)
+            throw std::string("Corrupt compressed text");
+        size_t offset = in[0] | (in[1] << 8);
+        in += 2;
+        size_t matchLength = getLength(token & 15) + MIN_MATCH;
+        if (offset == 0 || offset > written || matchLength > length - written)
+            throw std::string("Corrupt compressed text");
+        const char* from = dest + written - offset;
+        if (offset >= 8) {
+            copyWide(dest + written, from, matchLength);
+        } else {
+            // Byte by byte, since the match overlaps the text it copies
+            for (size_t k = 0; k < matchLength; k++)
+                dest[written + k] = from[k];
+        }
+        written += matchLength;
+    }
+    if (written != length)
+        throw std::string("Corrupt compressed text");
+    out.resize(length);
+}
@@ -0,0 +1,19 @@
+/*
+ * A small LZ77 codec for blocks of text, in the spirit of LZ4: the output is
+ * a sequence of literal runs and back-references, with no entropy coding, so
+ * both directions are a single fast pass over the bytes. Repetitive text like
+ * logs and CSVs shrinks several times over.
+ * Back-references reach at most 64 KB back, so blocks larger than that only
+ * compress against their most recent 64 KB.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// Compresses a block of text
+std::string compressBlock(std::string_view text);
+// Decompresses a block into `out`, replacing its contents. `length` is the
+// length of the original text. Throws a string if the block is corrupt.
+void decompressBlock(std::string_view packed, size_t length, std::string& out);
@@ -0,0 +1,269 @@
+#include "EditJournal.h"
+
+#include <cstring>
+#include <sys/stat.h>
+#include "Trace.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+// The journal starts with this, followed by the size and modification time
+// of the file it was started from. Each record after that is:
+//   kind ('I' for inserted text, 'D' for deleted text), 1 byte
+//   line and column of the edit, 4 bytes each
+//   length of the text, 8 bytes
+//   the inserted text (deleted text isn't needed to replay the edit)
+//   checksum of all of the above, 4 bytes
+// Numbers are in the machine's byte order, as the journal is never moved
+// to another machine.
+const char MAGIC[8] = {'t', 'e', 'k', 's', 't', 'j', '1', '\n'};
+const size_t HEADER_SIZE = sizeof(MAGIC) + 16;
+const size_t RECORD_SIZE = 1 + 4 + 4 + 8 + 4;
+
+template <typename T>
+static void appendNumber(std::string& out, T value) {
+    out.append((const char*) &value, sizeof(value));
+}
+
+template <typename T>
+static T readNumber(const char* in) {
+    T value;
+    memcpy(&value, in, sizeof(value));
+    return value;
+}
+
+// FNV-1a, which catches records torn by a crash
+static uint32_t checksum(std::string_view data) {
+    uint32_t hash = 2166136261u;
+    for (char c : data)
+        hash = (hash ^ (unsigned char) c) * 16777619u;
+    return hash;
+}
+
+// Header of a journal for the file as it is now
+static std::string journalHeader(const std::string& filename) {
+    uint64_t size = 0;
+    int64_t modified = 0;
+    struct stat st;
+    if (stat(filename.c_str(), &st) == 0) {
+        size = st.st_size;
+#ifdef __linux__
+        modified = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#else
+        modified = st.st_mtime;
+#endif
+    }
+    std::string header(MAGIC, sizeof(MAGIC));
+    appendNumber(header, size);
+    appendNumber(header, modified);
+    return header;
+}
+
+// Applies the records to the buffer, stopping at the first one that is
+// incomplete or doesn't match its checksum. Sets `used` to the length of
+// the records applied, and returns how many there were.
+static size_t replay(Buffer* b, std::string_view records, size_t* used) {
+    // Typing leaves a record per char, so runs of inserted text are joined
+    // into one edit, with chars deleted from them (by backspace) cut out
+    std::string text;
+    uint textLine = 0, textCol = 0;
+    auto insertJoined = [&]() {
+        b->insertText(textLine, textCol, text);
+        text.clear();
+    };
+    size_t count = 0;
+    size_t offset = 0;
+    while (records.length() - offset >= RECORD_SIZE) {
+        const char* record = records.data() + offset;
+        char kind = record[0];
+        uint line = readNumber<uint32_t>(record + 1);
+        uint col = readNumber<uint32_t>(record + 5);
+        uint64_t length = readNumber<uint64_t>(record + 9);
+        uint64_t textLength = kind == 'I' ? length : 0;
+        if ((kind != 'I' && kind != 'D') || records.length() - offset - RECORD_SIZE < textLength)
+            break;
+        size_t checked = RECORD_SIZE - 4 + textLength;
+        if (checksum(records.substr(offset, checked)) != readNumber<uint32_t>(record + checked))
+            break;
+        // Joined text is on one line unless it ends with a line feed
+        bool joinable = !text.empty() && line == textLine && text.find('\n') == std::string::npos;
+        if (kind == 'I') {
+            std::string_view added(record + RECORD_SIZE - 4, length);
+            if (!joinable || col != textCol + text.length()) {
+                insertJoined();
+                textLine = line;
+                textCol = col;
+            }
+            text.append(added);
+        } else if (joinable && col >= textCol && col - textCol <= text.length()
+                && length <= text.length() - (col - textCol)) {
+            text.erase(col - textCol, length);
+        } else {
+            insertJoined();
+            b->deleteRange(line, col, length);
+        }
+        offset += checked + 4;
+        count++;
+    }
+    insertJoined();
+    *used = offset;
+    return count;
+}
+
+EditJournal::EditJournal(const std::string& filename)
+    : filename(filename), journalFilename(filename + ".tekst-journal") {}
+
+EditJournal::~EditJournal() {
+    if (thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        thread.join();
+    }
+    if (!file)
+        return;
+    fclose(file);
+    if (!kept)
+        std::remove(journalFilename.c_str());
+}
+
+size_t EditJournal::start(Buffer* b) {
+    std::string journal;
+    if (FILE* in = fopen(journalFilename.c_str(), "rb")) {
+        char chunk[1 << 16];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0)
+            journal.append(chunk, n);
+        fclose(in);
+    }
+    size_t replayed = 0;
+    size_t used = 0;
+    if (journal.length() >= HEADER_SIZE) {
+        if (journal.compare(0, HEADER_SIZE, journalHeader(filename)) == 0) {
+            replayed = replay(b, std::string_view(journal).substr(HEADER_SIZE), &used);
+            trace("EditJournal | Replayed %zu edits from %s, dropped %zu bytes after them", replayed,
+                journalFilename.c_str(), journal.length() - HEADER_SIZE - used);
+        } else {
+            trace("EditJournal | Ignoring %s, which is for another version of the file", journalFilename.c_str());
+        }
+    }
+    // The new journal holds the replayed records (without any torn one
+    // after them), since they haven't been saved yet either
+    create(used > 0 ? std::string_view(journal).substr(HEADER_SIZE, used) : std::string_view());
+    b->addChangeListener([this](uint line, uint col, std::string_view removed, std::string_view added) {
+        record(line, col, removed, added);
+    });
+    thread = std::thread(&EditJournal::run, this);
+    return replayed;
+}
+
+void EditJournal::rebase(uint64_t mark) {
+    std::unique_lock<std::mutex> lock(mutex);
+    flush(lock);
+    if (failed)
+        throw std::string("Unable to write journal: ") + journalFilename;
+    // Read back the records made while the snapshot was being saved
+    std::string records;
+    fclose(file);
+    file = nullptr;
+    FILE* in = fopen(journalFilename.c_str(), "rb");
+    if (!in)
+        throw std::string("Unable to read journal: ") + journalFilename;
+    if (fseek(in, HEADER_SIZE + mark, SEEK_SET) == 0) {
+        char chunk[1 << 16];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0)
+            records.append(chunk, n);
+    }
+    fclose(in);
+    create(records);
+}
+
+void EditJournal::record(uint line, uint col, std::string_view removed, std::string_view added) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (failed || !file)
+            return;
+        size_t start = pending.length();
+        auto append = [&](char kind, size_t length, std::string_view text) {
+            size_t recordStart = pending.length();
+            pending.push_back(kind);
+            appendNumber<uint32_t>(pending, line);
+            appendNumber<uint32_t>(pending, col);
+            appendNumber<uint64_t>(pending, length);
+            pending.append(text);
+            appendNumber(pending, checksum(std::string_view(pending).substr(recordStart)));
+        };
+        if (!removed.empty())
+            append('D', removed.length(), "");
+        if (!added.empty())
+            append('I', added.length(), added);
+        recorded += pending.length() - start;
+    }
+    wake.notify_one();
+}
+
+void EditJournal::create(std::string_view records) {
+    if (file)
+        fclose(file);
+    file = nullptr;
+    // Written whole and renamed over the old journal, so there is always
+    // a complete journal in place
+    std::string newFilename = journalFilename + "-new";
+    FILE* f = fopen(newFilename.c_str(), "wb");
+    if (!f)
+        throw std::string("Unable to write journal: ") + journalFilename;
+    std::string header = journalHeader(filename);
+    bool failed = fwrite(header.data(), 1, header.length(), f) != header.length()
+        || fwrite(records.data(), 1, records.length(), f) != records.length();
+#ifndef _WIN32
+    failed = failed || fflush(f) != 0 || fsync(fileno(f)) != 0;
+#endif
+    if (fclose(f) != 0 || failed) {
+        std::remove(newFilename.c_str());
+        throw std::string("Unable to write journal: ") + journalFilename;
+    }
+#ifdef _WIN32
+    // rename() doesn't replace existing files on Windows
+    std::remove(journalFilename.c_str());
+#endif
+    if (std::rename(newFilename.c_str(), journalFilename.c_str()) != 0)
+        throw std::string("Unable to write journal: ") + journalFilename;
+    file = fopen(journalFilename.c_str(), "ab");
+    if (!file)
+        throw std::string("Unable to write journal: ") + journalFilename;
+    recorded = records.length();
+}
+
+void EditJournal::flush(std::unique_lock<std::mutex>& lock) {
+    idle.wait(lock, [&]() { return pending.empty() && !writing; });
+}
+
+void EditJournal::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    std::string batch;
+    while (true) {
+        wake.wait(lock, [&]() { return stopping || !pending.empty(); });
+        if (pending.empty())
+            return;
+        // Everything queued so far is written and synced together, while
+        // the edits made in the meantime queue up for the next batch
+        batch.swap(pending);
+        writing = true;
+        lock.unlock();
+        bool ok = fwrite(batch.data(), 1, batch.length(), file) == batch.length() && fflush(file) == 0;
+#ifndef _WIN32
+        ok = ok && fsync(fileno(file)) == 0;
+#endif
+        trace("EditJournal | Wrote %zu bytes%s", batch.length(), ok ? "" : ", failed");
+        batch.clear();
+        lock.lock();
+        writing = false;
+        if (!ok)
+            failed = true;
+        idle.notify_all();
+    }
+}
@@ -0,0 +1,77 @@
+/*
+ * EditJournal keeps an append-only log of the edits made to a buffer in a
+ * file next to the one being edited, so that unsaved edits survive a crash
+ * without having to save the whole file. Edits are queued as they are made
+ * and written by a background thread, which syncs everything queued since
+ * its last sync at once (group commit), so a burst of typing costs one
+ * fsync instead of one per key.
+ * The journal is removed when the editor exits cleanly. If it is still there
+ * when the file is opened again, its edits are replayed onto the buffer, as
+ * long as the file is the same as when the journal was started (same size
+ * and modification time). After a save, the journal is started over from
+ * the saved file with only the edits made since.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "Buffer.h"
+
+class EditJournal {
+    public:
+        // Uses the journal of a file, which isn't touched until start()
+        EditJournal(const std::string& filename);
+        // Writes queued edits, and removes the journal unless keep() was called
+        ~EditJournal();
+        EditJournal(const EditJournal&) = delete;
+        EditJournal& operator=(const EditJournal&) = delete;
+
+        // Replays the edits of a journal left behind for the file onto the
+        // buffer (as edits that can be undone), then starts a new journal
+        // holding them and records the buffer's edits from then on.
+        // Returns the number of edits replayed. Throws a string if the
+        // journal can't be written.
+        size_t start(Buffer* b);
+        // Position in the journal after the edits made so far, to be taken
+        // along with a snapshot that is going to be saved
+        uint64_t mark() const { return recorded; }
+        // Called after the snapshot taken at `mark` was saved to the file:
+        // starts the journal over from the saved file, keeping the edits made
+        // after the snapshot. Throws a string if the journal can't be written.
+        void rebase(uint64_t mark);
+        // Leaves the journal in place when destroyed, so that its edits are
+        // replayed next time (e.g. when they couldn't be saved on exit)
+        void keep() { kept = true; }
+    private:
+        std::string filename;
+        std::string journalFilename;
+        FILE* file = nullptr;
+        // Bytes of records queued or written since the header
+        uint64_t recorded = 0;
+        bool kept = false;
+
+        std::thread thread;
+        // Guards everything below, which the writer thread shares
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable idle;
+        // Records waiting to be written, and whether the writer is busy
+        // writing others
+        std::string pending;
+        bool writing = false;
+        bool stopping = false;
+        bool failed = false;
+
+        // Queues a record of an edit
+        void record(uint line, uint col, std::string_view removed, std::string_view added);
+        // Replaces the journal with one for the file as it is now, holding `records`
+        void create(std::string_view records);
+        // Waits until all queued records are written. The mutex must be held.
+        void flush(std::unique_lock<std::mutex>& lock);
+        void run();
+};
@@ -0,0 +1,273 @@
+#include "EditorServer.h"
+
+#include <cerrno>
+#include <sys/stat.h>
+#include <thread>
+#include "Trace.h"
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// Size and modification time of a file, to tell whether it changed on disk
+static void fileStamp(const std::string& path, uint64_t* size, int64_t* modified) {
+    *size = 0;
+    *modified = 0;
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return;
+    *size = st.st_size;
+#ifdef __linux__
+    *modified = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#else
+    *modified = st.st_mtime;
+#endif
+}
+
+#ifndef _WIN32
+
+EditorServer::EditorServer(const std::string& socketPath) : socketPath(socketPath) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.empty() || socketPath.length() >= sizeof(address.sun_path))
+        throw std::string("Invalid socket path: ") + socketPath;
+    memcpy(address.sun_path, socketPath.c_str(), socketPath.length());
+    // Editors only connect to a socket in a directory no one else can write
+    // to. The default one in /tmp is made on first use.
+    size_t slash = socketPath.rfind('/');
+    if (slash != std::string::npos && slash > 0)
+        mkdir(socketPath.substr(0, slash).c_str(), 0700);
+    if (!isPrivateSocketDir(socketPath))
+        throw std::string("Socket directory can be written by other users: ") + socketPath;
+    // A socket left behind by a server that didn't exit cleanly is replaced,
+    // but not one that a server is still listening at
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    bool running = probe >= 0 && connect(probe, (const sockaddr*) &address, sizeof(address)) == 0;
+    if (probe >= 0)
+        ::close(probe);
+    if (running)
+        throw std::string("A server is already listening at ") + socketPath;
+    unlink(socketPath.c_str());
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0)
+        throw std::string("Unable to create socket");
+    // Only the user can connect, since editors can open any of their files
+    mode_t oldMask = umask(0077);
+    bool bound = bind(listenFd, (const sockaddr*) &address, sizeof(address)) == 0;
+    umask(oldMask);
+    if (!bound || listen(listenFd, 16) != 0) {
+        ::close(listenFd);
+        throw std::string("Unable to listen at ") + socketPath;
+    }
+    // Writes to editors that exited fail instead of stopping the server
+    signal(SIGPIPE, SIG_IGN);
+}
+
+EditorServer::~EditorServer() {
+    ::close(listenFd);
+    unlink(socketPath.c_str());
+}
+
+void EditorServer::run() {
+    while (true) {
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::string("Unable to accept editors at ") + socketPath;
+        }
+        if (!peerIsUser(fd)) {
+            trace("EditorServer | Refused editor of another user");
+            ::close(fd);
+            continue;
+        }
+        std::thread(&EditorServer::serve, this, fd).detach();
+    }
+}
+
+#else
+
+EditorServer::EditorServer(const std::string& socketPath) : socketPath(socketPath) {
+    throw std::string("The server isn't supported on Windows");
+}
+
+EditorServer::~EditorServer() {}
+
+void EditorServer::run() {}
+
+#endif
+
+void EditorServer::serve(int fd) {
+    RemoteOp op;
+    std::string payload;
+    RemoteReply reply;
+    // The first request opens the file, and the rest are for it
+    std::string key;
+    std::shared_ptr<OpenFile> file;
+    bool closed = false;
+    while (receiveRequest(fd, &op, &payload)) {
+        reply.status = RemoteStatus::Ok;
+        reply.payload.clear();
+        if (!file && op == RemoteOp::Open && !payload.empty() && (uint8_t) payload[0] <= BufferType::PagedBufferType) {
+            BufferType type = (BufferType) payload[0];
+            std::string path = payload.substr(1);
+            key = Buffer::bufferTypeToString(type) + ":" + path;
+            try {
+                bool recovered;
+                file = open(key, type, path, &recovered);
+                std::lock_guard<std::mutex> lock(file->mutex);
+                reply.payload.push_back(file->buffer->isReadOnly());
+                reply.payload.push_back(recovered);
+                handle(*file, RemoteOp::Poll, "", &reply);
+            } catch (std::string msg) {
+                reply.status = RemoteStatus::Error;
+                reply.payload = msg;
+            }
+        } else if (file && op != RemoteOp::Open) {
+            closed = op == RemoteOp::Close;
+            std::lock_guard<std::mutex> lock(file->mutex);
+            handle(*file, op, payload, &reply);
+        } else {
+            reply.status = RemoteStatus::Error;
+            reply.payload = "Invalid request";
+        }
+        if (!sendReply(fd, reply))
+            break;
+    }
+#ifndef _WIN32
+    ::close(fd);
+#endif
+    if (file)
+        close(key, closed);
+}
+
+std::shared_ptr<EditorServer::OpenFile> EditorServer::open(const std::string& key, BufferType type, const std::string& path, bool* recovered) {
+    std::shared_ptr<OpenFile> file;
+    bool loaded;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::shared_ptr<OpenFile>& entry = files[key];
+        if (!entry)
+            entry = std::make_shared<OpenFile>();
+        file = entry;
+        loaded = file->editors > 0;
+        file->editors++;
+    }
+    // Loaded outside the server's mutex, so that editors opening other
+    // files don't wait for it, while ones opening this file do
+    std::unique_lock<std::mutex> fileLock(file->mutex);
+    uint64_t size;
+    int64_t modified;
+    fileStamp(path, &size, &modified);
+    // A file no editor has open can be loaded again, which it is if it
+    // changed on disk, dropping edits left by editors that crashed like the
+    // edit journal does. One that is open stays as the editors see it.
+    *recovered = false;
+    if (file->buffer && (loaded || (size == file->size && modified == file->modified))) {
+        *recovered = !loaded && file->version != file->savedVersion;
+        trace("EditorServer | Reusing %s%s", key.c_str(), *recovered ? " with unsaved edits" : "");
+        return file;
+    }
+    try {
+        std::string filename = path;
+        file->buffer = Buffer::createBuffer(type, filename.data());
+    } catch (std::string msg) {
+        file->buffer.reset();
+        fileLock.unlock();
+        close(key, true);
+        throw;
+    }
+    // Each editor keeps the undo history of its own edits
+    file->buffer->history.setMaxBytes(0);
+    file->path = path;
+    file->version = 0;
+    file->savedVersion = 0;
+    file->size = size;
+    file->modified = modified;
+    trace("EditorServer | Loaded %s", key.c_str());
+    return file;
+}
+
+void EditorServer::close(const std::string& key, bool closed) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = files.find(key);
+    if (it == files.end() || --it->second->editors > 0)
+        return;
+    std::shared_ptr<OpenFile> file = it->second;
+    std::lock_guard<std::mutex> fileLock(file->mutex);
+    if (!file->buffer || (closed && file->version != file->savedVersion)) {
+        trace("EditorServer | Dropping %s", key.c_str());
+        files.erase(it);
+    } else if (file->version != file->savedVersion) {
+        trace("EditorServer | Keeping unsaved edits of %s", key.c_str());
+    }
+}
+
+void EditorServer::handle(OpenFile& file, RemoteOp op, std::string_view payload, RemoteReply* reply) {
+    Buffer* b = file.buffer.get();
+    size_t offset = 0;
+    switch (op) {
+        case RemoteOp::Open:
+        case RemoteOp::Poll:
+        case RemoteOp::Close:
+            break;
+        case RemoteOp::LineCount:
+            b->lineCount();
+            break;
+        case RemoteOp::Saved:
+            // The file is now as the text was at that version, so edits
+            // left by editors that crash are kept as long as it stays so
+            file.savedVersion = readNumber<uint64_t>(payload, offset);
+            fileStamp(file.path, &file.size, &file.modified);
+            break;
+        case RemoteOp::Lines: {
+            uint firstLine = readNumber<uint32_t>(payload, offset);
+            uint count = readNumber<uint32_t>(payload, offset);
+            size_t fromCol = readNumber<uint64_t>(payload, offset);
+            size_t width = readNumber<uint64_t>(payload, offset);
+            appendNumber<uint32_t>(reply->payload, 0);
+            uint visited = b->visitLineSlices(firstLine, count, fromCol, width, [&](uint, const LineSlice& slice) {
+                appendNumber<uint64_t>(reply->payload, slice.length);
+                appendNumber<uint8_t>(reply->payload, slice.hasNewline);
+                appendNumber<uint64_t>(reply->payload, slice.text.length());
+                reply->payload.append(slice.text);
+            });
+            memcpy(reply->payload.data(), &visited, sizeof(uint32_t));
+            break;
+        }
+        case RemoteOp::Insert: {
+            int line = readNumber<uint32_t>(payload, offset);
+            int col = readNumber<uint32_t>(payload, offset);
+            b->insertText(line, col, payload.substr(std::min(offset, payload.length())));
+            file.version++;
+            break;
+        }
+        case RemoteOp::Delete: {
+            int line = readNumber<uint32_t>(payload, offset);
+            int col = readNumber<uint32_t>(payload, offset);
+            b->deleteRange(line, col, readNumber<uint64_t>(payload, offset));
+            file.version++;
+            break;
+        }
+        case RemoteOp::Snapshot: {
+            bool unchanged = readNumber<uint64_t>(payload, offset) == file.version;
+            reply->payload.push_back(unchanged);
+            if (unchanged)
+                break;
+            std::unique_ptr<Snapshot> snapshot = b->snapshot();
+            reply->payload.reserve(1 + snapshot->size());
+            std::string scratch;
+            for (size_t i = 0; i < snapshot->pieces.size(); i++)
+                reply->payload.append(snapshot->readPiece(i, scratch));
+            break;
+        }
+        // No default case so that op enum and switch statement synchronization
+        // checked by compiler.
+    }
+    reply->version = file.version;
+    // Opening a huge file doesn't wait for its lines to be counted
+    reply->lines = b->knownLineCount();
+}
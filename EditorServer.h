@@ -0,0 +1,72 @@
+/*
+ * EditorServer holds buffers for editors that connect to it over a Unix
+ * domain socket (see RemoteBuffer), so that a file is loaded once however
+ * many editors have it open, and stays loaded after they exit so that
+ * opening it again is instant. It is loaded again if it changed on disk in
+ * the meantime. Unsaved edits are lost when the last editor with the file
+ * open exits, like they are without a server. If it crashed instead, they
+ * are kept for when the file is opened again (unless it changed on disk),
+ * like the edit journal keeps them without a server.
+ * Each editor is served on a thread of its own, and the buffer it has open
+ * is locked while one of its requests is handled.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "Buffer.h"
+#include "RemoteProtocol.h"
+
+class EditorServer {
+    public:
+        // Listens at `socketPath`. Throws a string if it can't, or if
+        // another server is already listening there.
+        EditorServer(const std::string& socketPath);
+        ~EditorServer();
+        EditorServer(const EditorServer&) = delete;
+        EditorServer& operator=(const EditorServer&) = delete;
+        // Serves editors until the process is stopped
+        void run();
+    private:
+        struct OpenFile {
+            // Held while loading the buffer and handling a request
+            std::mutex mutex;
+            std::unique_ptr<Buffer> buffer;
+            std::string path;
+            // Number of edits made since the buffer was loaded
+            uint64_t version = 0;
+            // Version that was last saved to the file
+            uint64_t savedVersion = 0;
+            // Size and modification time of the file when it was loaded or
+            // last saved
+            uint64_t size = 0;
+            int64_t modified = 0;
+            // Editors with the file open. Only changed while the server's
+            // mutex is held.
+            size_t editors = 0;
+        };
+
+        std::string socketPath;
+        int listenFd = -1;
+        // Guards `files`
+        std::mutex mutex;
+        // Open files by buffer type and path
+        std::map<std::string, std::shared_ptr<OpenFile>> files;
+
+        // Handles the requests of one editor until it disconnects
+        void serve(int fd);
+        // Opens a file for an editor, loading it if it isn't loaded or
+        // changed on disk. Sets `recovered` if the buffer has unsaved edits
+        // of editors that disconnected without closing it. Throws a string
+        // if it can't be loaded.
+        std::shared_ptr<OpenFile> open(const std::string& key, BufferType type, const std::string& path, bool* recovered);
+        // Called when an editor with a file open disconnects, `closed` if
+        // it closed the file before
+        void close(const std::string& key, bool closed);
+        // Handles a request for an open file, setting the payload of the reply
+        void handle(OpenFile& file, RemoteOp op, std::string_view payload, RemoteReply* reply);
+};
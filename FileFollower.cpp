@@ -0,0 +1,105 @@
+#include "FileFollower.h"
+
+#include <fstream>
+#include <sys/stat.h>
+#include "Trace.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+FileFollower::FileFollower(const std::string& filename) : filename(filename) {
+    struct stat st;
+    if (stat(filename.c_str(), &st) == 0)
+        followFromEnd(st);
+#ifdef __linux__
+    notifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+    addWatch();
+    trace("FileFollower | Following %s from %zu bytes, %s", filename.c_str(), offset,
+        notifyFd < 0 ? "polling" : "using inotify");
+}
+
+FileFollower::~FileFollower() {
+#ifdef __linux__
+    if (notifyFd >= 0)
+        close(notifyFd);
+#endif
+}
+
+void FileFollower::followFromEnd(const struct stat& st) {
+    offset = st.st_size;
+    inode = st.st_ino;
+    lineOpen = false;
+    if (offset > 0) {
+        std::ifstream file(filename, std::ios::binary);
+        char last;
+        if (file.seekg(offset - 1) && file.get(last))
+            lineOpen = last != '\n';
+    }
+}
+
+void FileFollower::addWatch() {
+#ifdef __linux__
+    if (notifyFd < 0)
+        return;
+    if (watch >= 0)
+        inotify_rm_watch(notifyFd, watch);
+    watch = inotify_add_watch(notifyFd, filename.c_str(), IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+#endif
+}
+
+bool FileFollower::readEvents() {
+#ifdef __linux__
+    // Only whether there were events matters, not what they were
+    bool any = false;
+    char events[4096];
+    while (read(notifyFd, events, sizeof(events)) > 0)
+        any = true;
+    return any;
+#else
+    return true;
+#endif
+}
+
+FileFollower::Change FileFollower::poll(std::string* appended, bool* continuesLine) {
+    if (notifyFd >= 0 && readEvents())
+        changed = true;
+    // Without a watch (e.g. the file was moved away and its name isn't
+    // taken yet), the name has to be checked every time
+    if (!changed && watch >= 0)
+        return Change::None;
+    changed = false;
+
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) {
+        // Moved or deleted, and not replaced yet
+        changed = true;
+        return Change::None;
+    }
+    if ((unsigned long) st.st_ino != inode || (size_t) st.st_size < offset) {
+        trace("FileFollower | %s was replaced or truncated", filename.c_str());
+        followFromEnd(st);
+        addWatch();
+        return Change::Replaced;
+    }
+    if ((size_t) st.st_size == offset)
+        return Change::None;
+
+    std::ifstream file(filename, std::ios::binary);
+    std::string text(st.st_size - offset, '\0');
+    file.seekg(offset);
+    if (!file.read(&text[0], text.length()))
+        return Change::None;
+    // A line still being written is read again once it is complete
+    size_t end = text.rfind('\n');
+    if (end == std::string::npos)
+        return Change::None;
+    text.resize(end + 1);
+    offset += text.length();
+    *appended = std::move(text);
+    *continuesLine = lineOpen;
+    lineOpen = false;
+    return Change::Appended;
+}
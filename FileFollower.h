@@ -0,0 +1,53 @@
+/*
+ * FileFollower watches a file for text appended to it, like `tail -f`, so
+ * that the buffer showing the file can be kept up to date. Only the bytes
+ * added since the last check are read, and only up to the last line feed,
+ * so that a line still being written is added once it is complete. If the
+ * file's last line had no line feed when it was read, the text that ends it
+ * is marked as continuing it.
+ * If the file gets shorter, or another file takes its name (as when a log
+ * is rotated), the whole file has to be read again.
+ * On Linux, inotify tells when the file changes, and the file is only
+ * checked then. Elsewhere it is checked every time it is polled.
+ */
+
+#pragma once
+
+#include <string>
+
+class FileFollower {
+    public:
+        enum class Change { None, Appended, Replaced };
+
+        // Starts following a file from its current end
+        FileFollower(const std::string& filename);
+        ~FileFollower();
+        FileFollower(const FileFollower&) = delete;
+        FileFollower& operator=(const FileFollower&) = delete;
+
+        // Checks for changes without blocking. If lines were appended, they
+        // are set in `appended`, and `continuesLine` tells whether they
+        // start by ending the line that was last in the file (see
+        // Buffer::appendText). If the file was replaced, it is followed from
+        // its end again.
+        Change poll(std::string* appended, bool* continuesLine);
+    private:
+        std::string filename;
+        // Offset after the last line feed read, and the file's identity
+        size_t offset = 0;
+        unsigned long inode = 0;
+        // Whether the file had no line feed before `offset`
+        bool lineOpen = false;
+        // inotify instance and watch on the file, or -1
+        int notifyFd = -1;
+        int watch = -1;
+        // Whether the file has to be checked on the next poll
+        bool changed = true;
+
+        // Starts following the file from its end
+        void followFromEnd(const struct stat& st);
+        // Starts watching the file under its name, which may be a new file
+        void addWatch();
+        // Whether inotify reported events since the last call
+        bool readEvents();
+};
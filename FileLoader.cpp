@@ -0,0 +1,151 @@
+#include "FileLoader.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include "Trace.h"
+#include "Utils.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Files smaller than this per thread aren't worth splitting up
+const size_t MIN_CHUNK = 1 << 20;
+const size_t MAX_THREADS = 16;
+
+// Result of scanning one chunk of the file
+struct ChunkResult {
+    // Length of the chunk after removing carriage returns
+    size_t length = 0;
+    // Lengths of lines ending in this chunk. The first one only counts the
+    // part of the line within this chunk.
+    std::vector<size_t> lineLengths;
+};
+
+// Scans a chunk for line feeds and removes the carriage returns preceding them,
+// compacting the chunk in place. `nextIsLineFeed` is whether the byte after
+// the chunk is a line feed, since a CR at the end of this chunk then has to
+// be removed too.
+static void scanChunk(char* text, size_t n, bool nextIsLineFeed, ChunkResult* result) {
+    size_t write = 0; // End of compacted output
+    size_t copied = 0; // Input before this has been copied to the output
+    size_t lineStart = 0; // Output position where current line started
+
+    // Removes the CR at input position `pos`, moving text before it into place
+    auto dropCarriageReturn = [&](size_t pos) {
+        if (write != copied)
+            memmove(text + write, text + copied, pos - copied);
+        write += pos - copied;
+        copied = pos + 1;
+    };
+    auto foundLineFeed = [&](size_t pos) {
+        if (pos > 0 && text[pos - 1] == '\r')
+            dropCarriageReturn(pos - 1);
+        size_t outPos = write + (pos - copied);
+        result->lineLengths.push_back(outPos + 1 - lineStart);
+        lineStart = outPos + 1;
+    };
+
+    size_t i = 0;
+#ifdef __SSE2__
+    // Compare 16 bytes at a time and visit each set bit of the match mask.
+    // Compaction only writes behind the position being read, so it is safe
+    // to do while scanning.
+    const __m128i lineFeeds = _mm_set1_epi8('\n');
+    for (; i + 16 <= n; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*) (text + i));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, lineFeeds));
+        while (mask) {
+            foundLineFeed(i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if (text[i] == '\n')
+            foundLineFeed(i);
+    }
+
+    size_t end = n;
+    if (nextIsLineFeed && n > 0 && text[n - 1] == '\r')
+        end--;
+    if (write != copied && end > copied)
+        memmove(text + write, text + copied, end - copied);
+    result->length = write + (end > copied ? end - copied : 0);
+}
+
+LoadedFile loadFile(const std::string& filename) {
+    LoadedFile file;
+    // Binary mode so that CRs are found and stripped the same way on all platforms
+    FILE* f = fopen(filename.c_str(), "rb");
+    if (f) {
+        file.exists = true;
+        fseek(f, 0, SEEK_END);
+        long length = std::max(0L, ftell(f));
+        fseek(f, 0, SEEK_SET);
+        // One extra byte in case a final line feed has to be added
+        file.text.reserve(length + 1);
+        file.text.resize(length);
+        size_t read = fread(&file.text[0], 1, length, f);
+        file.text.resize(read);
+        fclose(f);
+    }
+    size_t length = file.text.length();
+
+    // Split into one chunk per thread
+    size_t threads = std::min({(size_t) std::max(1u, std::thread::hardware_concurrency()),
+        MAX_THREADS, std::max((size_t) 1, length / MIN_CHUNK)});
+    std::vector<size_t> bounds;
+    for (size_t i = 0; i <= threads; i++)
+        bounds.push_back(length * i / threads);
+    std::vector<ChunkResult> results(threads);
+    // Recorded before scanning, since chunks are modified in place while scanning
+    std::vector<bool> nextIsLineFeed(threads);
+    for (size_t i = 0; i < threads; i++)
+        nextIsLineFeed[i] = bounds[i + 1] < length && file.text[bounds[i + 1]] == '\n';
+
+    char* text = &file.text[0];
+    parallelFor(threads, [&](size_t i) {
+        scanChunk(text + bounds[i], bounds[i + 1] - bounds[i], nextIsLineFeed[i], &results[i]);
+    });
+
+    // Stitch chunks together, moving compacted chunks next to each other
+    // and joining lines that cross chunk boundaries.
+    size_t lineCount = 0;
+    for (const ChunkResult& result : results)
+        lineCount += result.lineLengths.size();
+    file.lineLengths.reserve(lineCount + 2);
+    size_t write = 0;
+    size_t carry = 0; // Length of the line continuing into the next chunk
+    for (size_t i = 0; i < threads; i++) {
+        const ChunkResult& result = results[i];
+        if (write != bounds[i])
+            memmove(text + write, text + bounds[i], result.length);
+        write += result.length;
+        if (result.lineLengths.empty()) {
+            carry += result.length;
+            continue;
+        }
+        file.lineLengths.push_back(carry + result.lineLengths[0]);
+        file.lineLengths.insert(file.lineLengths.end(), result.lineLengths.begin() + 1, result.lineLengths.end());
+        carry = result.length;
+        for (size_t lineLength : result.lineLengths)
+            carry -= lineLength;
+    }
+    file.text.resize(write);
+
+    // Every line read from a file is terminated. A CR ending the last line
+    // is removed like any other, which here means replacing it.
+    if (carry > 0 && file.text.back() == '\r') {
+        file.text.back() = '\n';
+        file.lineLengths.push_back(carry);
+    } else if (carry > 0) {
+        file.text.push_back('\n');
+        file.lineLengths.push_back(carry + 1);
+    }
+    file.lineLengths.push_back(0);
+    trace("FileLoader | Loaded %zu bytes, %zu lines using %zu threads", length, file.lineLengths.size(), threads);
+    return file;
+}
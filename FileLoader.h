@@ -0,0 +1,25 @@
+/*
+ * FileLoader reads a whole text file in bulk and normalizes it to tekst's
+ * conventions: CRLF line endings become LF, and the last line is always
+ * terminated. It also finds every line feed, so buffers can build their
+ * line structures without scanning the text again.
+ * The file is split into chunks which are scanned by worker threads with
+ * vectorized searches, and the per-chunk results are stitched together.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+struct LoadedFile {
+    // Whether the file existed. If not, the text is empty (a new file).
+    bool exists = false;
+    // Normalized contents of the file
+    std::string text;
+    // Length of each line including its line feed. There is always one more
+    // line than line feeds: the last is the empty line after the final one.
+    std::vector<size_t> lineLengths;
+};
+
+LoadedFile loadFile(const std::string& filename);
@@ -0,0 +1,190 @@
+#include "FileSaver.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "Trace.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <climits>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Size of each write. Text is copied into a block aligned to the page size
+// and written whole, so the OS gets large, aligned writes regardless of how
+// small the snapshot's pieces are.
+const size_t BLOCK_SIZE = 1 << 20;
+const size_t BLOCK_ALIGN = 4096;
+
+#ifndef _WIN32
+// Mode a new file gets, which mkstemp() doesn't apply to the file it creates.
+// Looked up once, from the thread starting the first save, since umask()
+// can only be read by changing it.
+static mode_t newFileMode() {
+    static const mode_t mode = []() {
+        mode_t mask = umask(077);
+        umask(mask);
+        return 0666 & ~mask;
+    }();
+    return mode;
+}
+#endif
+
+// Writes the snapshot's text to `f` in blocks, returning false on failure
+static bool writeBlocks(const Snapshot& snapshot, FILE* f, std::atomic<size_t>* progress) {
+    // Blocks are written directly, so stdio doesn't need its own buffer
+    setvbuf(f, nullptr, _IONBF, 0);
+    std::unique_ptr<char[]> memory(new char[BLOCK_SIZE + BLOCK_ALIGN]);
+    char* block = memory.get() + (BLOCK_ALIGN - (uintptr_t) memory.get() % BLOCK_ALIGN) % BLOCK_ALIGN;
+
+    bool failed = false;
+    size_t used = 0;
+    auto flush = [&]() {
+        if (used > 0 && fwrite(block, 1, used, f) != used)
+            failed = true;
+        if (progress)
+            *progress += used;
+        used = 0;
+    };
+    // Compressed pieces are decompressed one at a time as they are reached
+    std::string scratch;
+    for (size_t i = 0; i < snapshot.pieces.size() && !failed; i++) {
+        std::string_view piece = snapshot.readPiece(i, scratch);
+        while (!piece.empty() && !failed) {
+            size_t n = std::min(piece.length(), BLOCK_SIZE - used);
+            memcpy(block + used, piece.data(), n);
+            used += n;
+            piece.remove_prefix(n);
+            if (used == BLOCK_SIZE)
+                flush();
+        }
+    }
+    if (!failed)
+        flush();
+#ifndef _WIN32
+    // Make sure the text is on disk before it replaces the original
+    if (!failed && fsync(fileno(f)) != 0)
+        failed = true;
+#endif
+    return !failed;
+}
+
+#ifndef _WIN32
+// Writes over the file itself, for when no file can be created next to it.
+// A crash or error midway leaves the file partly written.
+static void rewriteInPlace(const Snapshot& snapshot, const std::string& target, const std::string& filename,
+        std::atomic<size_t>* progress) {
+    // The text read from the mapping would change as it is written
+    if (snapshot.mapsFile)
+        throw std::string("Unable to write to file (directory not writable): ") + filename;
+    trace("FileSaver | Directory of %s not writable, rewriting it in place", target.c_str());
+    FILE* f = fopen(target.c_str(), "r+b");
+    if (!f)
+        throw std::string("Unable to write to file: ") + filename;
+    bool written = writeBlocks(snapshot, f, progress);
+    // Cut off what is left of the old text if the new one is shorter
+    if (written && (ftruncate(fileno(f), ftello(f)) != 0 || fsync(fileno(f)) != 0))
+        written = false;
+    if (fclose(f) != 0 || !written)
+        throw std::string("Unable to write to file: ") + filename;
+}
+#endif
+
+void writeSnapshot(const Snapshot& snapshot, const std::string& filename, std::atomic<size_t>* progress) {
+    std::string target = filename;
+#ifndef _WIN32
+    // Saving through a symlink replaces the file it points to, so the link
+    // stays a link
+    char resolved[PATH_MAX];
+    if (realpath(filename.c_str(), resolved))
+        target = resolved;
+    // Each save gets a temporary file of its own, so that saves of the same
+    // file (e.g. from two editors) don't write over each other's
+    std::string tmpFilename = target + ".tekst-save-XXXXXX";
+    int fd = mkstemp(&tmpFilename[0]);
+    if (fd < 0 && (errno == EACCES || errno == EPERM) && access(target.c_str(), W_OK) == 0) {
+        rewriteInPlace(snapshot, target, filename, progress);
+        return;
+    }
+    FILE* f = fd < 0 ? nullptr : fdopen(fd, "wb");
+    if (!f) {
+        if (fd >= 0) {
+            close(fd);
+            std::remove(tmpFilename.c_str());
+        }
+        throw std::string("Unable to write to file: ") + filename;
+    }
+    // The new file replaces the original, so it takes the original's mode
+    // and owner. Set before writing, so that the text is never readable by
+    // more users than the original allowed. Changing the owner fails
+    // unless it is the user's own, in which case the mode is still kept.
+    struct stat original;
+    if (stat(target.c_str(), &original) == 0) {
+        if (fchown(fd, original.st_uid, original.st_gid) != 0)
+            trace("FileSaver | Unable to keep owner of %s", target.c_str());
+        fchmod(fd, original.st_mode & 07777);
+    } else {
+        fchmod(fd, newFileMode());
+    }
+#else
+    std::string tmpFilename = target + ".tekst-save";
+    FILE* f = fopen(tmpFilename.c_str(), "wb");
+    if (!f) {
+        throw std::string("Unable to write to file: ") + filename;
+    }
+#endif
+    bool written = writeBlocks(snapshot, f, progress);
+    if (fclose(f) != 0 || !written) {
+        std::remove(tmpFilename.c_str());
+        throw std::string("Unable to write to file: ") + filename;
+    }
+#ifdef _WIN32
+    // rename() doesn't replace existing files on Windows
+    std::remove(target.c_str());
+#endif
+    if (std::rename(tmpFilename.c_str(), target.c_str()) != 0) {
+        std::remove(tmpFilename.c_str());
+        throw std::string("Unable to replace file: ") + filename;
+    }
+}
+
+FileSaver::~FileSaver() {
+    if (thread.joinable())
+        thread.join();
+}
+
+void FileSaver::start(std::unique_ptr<Snapshot> snapshot, const std::string& filename) {
+    written = 0;
+    total = snapshot->size();
+    done = false;
+    failure.clear();
+    trace("FileSaver | Saving %zu bytes to %s", total, filename.c_str());
+#ifndef _WIN32
+    // Looked up here rather than on the save thread
+    newFileMode();
+#endif
+    // The thread owns the snapshot, and only touches the members above
+    // through atomics until `done` is set.
+    thread = std::thread([this, filename](std::unique_ptr<Snapshot> snapshot) {
+        try {
+            TraceTimer timer(TraceOp::Save);
+            writeSnapshot(*snapshot, filename, &written);
+        } catch (std::string msg) {
+            failure = msg;
+        }
+        done = true;
+    }, std::move(snapshot));
+}
+
+bool FileSaver::finish(std::string* error, bool wait) {
+    if (!thread.joinable() || (!done && !wait))
+        return false;
+    thread.join();
+    *error = failure;
+    trace("FileSaver | %s", failure.empty() ? "Saved" : failure.c_str());
+    return true;
+}
@@ -0,0 +1,48 @@
+/*
+ * FileSaver writes buffer snapshots to disk. The text is written to a
+ * temporary file of its own next to the target in large aligned blocks,
+ * which is then renamed over the target, so a crash or error mid-write never
+ * leaves a truncated file behind. The new file keeps the original's mode and
+ * owner, and a symlink is saved through, replacing the file it points to.
+ * If no file can be created in the target's directory, the target is
+ * rewritten in place instead, unless the snapshot is read from a mapping of
+ * it. Saves can run on a background thread while the buffer keeps being
+ * edited.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include "Buffer.h"
+
+// Writes a snapshot to a file, only replacing the file once fully written.
+// Adds the number of bytes written so far to `progress` if given.
+// Throws a string on failure.
+void writeSnapshot(const Snapshot& snapshot, const std::string& filename, std::atomic<size_t>* progress);
+
+class FileSaver {
+    public:
+        // Waits for a save in progress to finish
+        ~FileSaver();
+        // Starts writing a snapshot to a file on a background thread.
+        // Must not be called while busy.
+        void start(std::unique_ptr<Snapshot> snapshot, const std::string& filename);
+        // Whether a save was started and hasn't been collected by finish() yet
+        bool busy() const { return thread.joinable(); }
+        // If the save has finished (or `wait` is set and one is running), collects
+        // it and returns true. `error` is set to the failure message, or cleared
+        // if the save succeeded.
+        bool finish(std::string* error, bool wait);
+        size_t bytesWritten() const { return written; }
+        size_t totalBytes() const { return total; }
+    private:
+        std::thread thread;
+        std::atomic<size_t> written{0};
+        size_t total = 0;
+        std::atomic<bool> done{false};
+        // Set by the save thread before it sets `done`
+        std::string failure;
+};
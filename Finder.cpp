@@ -0,0 +1,273 @@
+#include "Finder.h"
+
+#include <algorithm>
+#include <cstring>
+#include "Trace.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Chunks are small enough that the first matches come back quickly, and
+// large enough that taking one is cheap compared to scanning it
+const size_t CHUNK_SIZE = 4 << 20;
+const size_t MAX_THREADS = 16;
+
+// Calls onMatch(pos) for every position where `needle` occurs in the text
+// (and fits in it), in order
+template <typename F>
+static void findAll(const char* text, size_t n, std::string_view needle, F onMatch) {
+    size_t m = needle.length();
+    if (m == 0 || n < m)
+        return;
+    size_t last = n - m; // Last position a match can start at
+    size_t i = 0;
+#ifdef __SSE2__
+    // Compare the first and last chars of the needle against 16 positions
+    // at a time, and only compare the rest where both match
+    const __m128i firstChars = _mm_set1_epi8(needle.front());
+    const __m128i lastChars = _mm_set1_epi8(needle.back());
+    for (; i + 15 <= last; i += 16) {
+        __m128i first = _mm_loadu_si128((const __m128i*) (text + i));
+        __m128i end = _mm_loadu_si128((const __m128i*) (text + i + m - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+            _mm_cmpeq_epi8(first, firstChars), _mm_cmpeq_epi8(end, lastChars)));
+        while (mask) {
+            size_t pos = i + __builtin_ctz(mask);
+            if (memcmp(text + pos, needle.data(), m) == 0)
+                onMatch(pos);
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i <= last; i++) {
+        if (text[i] == needle.front() && memcmp(text + i, needle.data(), m) == 0)
+            onMatch(i);
+    }
+}
+
+// Counts line feeds in the text, setting `lastEnd` to the position after
+// the last one if there are any
+static size_t countLineFeeds(const char* text, size_t n, size_t* lastEnd) {
+    size_t count = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i lineFeeds = _mm_set1_epi8('\n');
+    for (; i + 16 <= n; i += 16) {
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (text + i)), lineFeeds));
+        if (mask) {
+            count += __builtin_popcount(mask);
+            *lastEnd = i + 32 - __builtin_clz(mask);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if (text[i] == '\n') {
+            count++;
+            *lastEnd = i + 1;
+        }
+    }
+    return count;
+}
+
+Finder::~Finder() {
+    cancel();
+}
+
+void Finder::start(std::unique_ptr<Snapshot> newSnapshot, const std::string& newQuery, bool overlap) {
+    cancel();
+    snapshot = std::move(newSnapshot);
+    query = newQuery;
+    overlapping = overlap;
+    pieceStarts.assign(1, 0);
+    for (size_t i = 0; i < snapshot->pieces.size(); i++)
+        pieceStarts.push_back(pieceStarts.back() + snapshot->pieceLength(i));
+    size_t total = pieceStarts.back();
+    size_t chunkCount = query.empty() ? 0 : (total + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+    chunks.assign(chunkCount, ChunkResult());
+    resolvedChunks = 0;
+    resolvedLines = 0;
+    resolvedLineStart = 0;
+    resolvedEnd = 0;
+    nextChunk = 0;
+    cancelled = false;
+    done = chunkCount == 0;
+    size_t threads = std::min({(size_t) std::max(1u, std::thread::hardware_concurrency()), MAX_THREADS, chunkCount});
+    for (size_t i = 0; i < threads; i++)
+        workers.emplace_back(&Finder::work, this);
+    trace("Finder | Searching %zu bytes in %zu chunks using %zu threads", total, chunkCount, threads);
+}
+
+void Finder::cancel() {
+    cancelled = true;
+    for (std::thread& worker : workers)
+        worker.join();
+    workers.clear();
+    chunks.clear();
+    matches.clear();
+    snapshot.reset();
+    done = true;
+}
+
+size_t Finder::copyMatches(size_t from, std::vector<Match>* out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (from < matches.size())
+        out->insert(out->end(), matches.begin() + from, matches.end());
+    return matches.size();
+}
+
+std::string_view Finder::PieceReader::read(size_t i) {
+    if (snapshot->packed.empty() || !snapshot->packed[i].blockLength)
+        return snapshot->pieces[i];
+    if (pieces[last] != i) {
+        last = 1 - last;
+        if (pieces[last] != i) {
+            views[last] = snapshot->readPiece(i, texts[last]);
+            pieces[last] = i;
+        }
+    }
+    return views[last];
+}
+
+void Finder::work() {
+    size_t total = pieceStarts.back();
+    size_t chunk;
+    PieceReader reader(snapshot.get());
+    while (!cancelled && (chunk = nextChunk++) < chunks.size()) {
+        ChunkResult result;
+        scanChunk(chunk * CHUNK_SIZE, std::min(total, (chunk + 1) * CHUNK_SIZE), reader, &result);
+        result.done = true;
+        std::lock_guard<std::mutex> lock(mutex);
+        chunks[chunk] = std::move(result);
+        resolveChunks();
+    }
+}
+
+void Finder::scanChunk(size_t begin, size_t end, PieceReader& reader, ChunkResult* result) {
+    size_t m = query.length();
+    // Matches starting in this chunk can end in the next one
+    size_t searchEnd = std::min(pieceStarts.back(), end + m - 1);
+    size_t counted = begin; // Line feeds before this offset have been counted
+    size_t lineStart = std::string::npos;
+    std::string window;
+
+    size_t i = std::upper_bound(pieceStarts.begin(), pieceStarts.end(), begin) - pieceStarts.begin() - 1;
+    for (; i < snapshot->pieces.size() && pieceStarts[i] < searchEnd; i++) {
+        size_t pieceStart = pieceStarts[i];
+        size_t pieceEnd = pieceStarts[i + 1];
+        const char* text = reader.read(i).data();
+        // Counts line feeds up to an offset within this piece
+        auto countTo = [&](size_t to) {
+            if (to <= counted)
+                return;
+            size_t lastEnd = std::string::npos;
+            result->lineFeeds += countLineFeeds(text + (counted - pieceStart), to - counted, &lastEnd);
+            if (lastEnd != std::string::npos)
+                result->lastLineStart = lineStart = counted + lastEnd;
+            counted = to;
+        };
+        auto found = [&](size_t offset) {
+            countTo(offset);
+            result->matches.push_back({offset, result->lineFeeds, lineStart});
+        };
+
+        // Matches within this piece
+        size_t from = std::max(begin, pieceStart);
+        size_t to = std::min(searchEnd, pieceEnd);
+        if (to > from) {
+            findAll(text + (from - pieceStart), to - from, query, [&](size_t pos) {
+                if (from + pos < end)
+                    found(from + pos);
+            });
+        }
+        // Matches starting in this piece and continuing into the next ones,
+        // found by searching a copy of the text around the boundary
+        if (m > 1 && pieceEnd < searchEnd) {
+            size_t windowStart = std::max(from, pieceEnd - std::min(pieceEnd, m - 1));
+            window.clear();
+            appendRange(windowStart, std::min(pieceStarts.back(), pieceEnd + m - 1), reader, window);
+            findAll(window.data(), window.length(), query, [&](size_t pos) {
+                size_t offset = windowStart + pos;
+                if (offset < pieceEnd && offset < end)
+                    found(offset);
+            });
+        }
+        countTo(std::min(end, pieceEnd));
+    }
+}
+
+void Finder::resolveChunks() {
+    while (resolvedChunks < chunks.size() && chunks[resolvedChunks].done) {
+        ChunkResult& chunk = chunks[resolvedChunks];
+        for (const ChunkMatch& match : chunk.matches) {
+            // Skip matches overlapping the previous one
+            if (!overlapping && match.offset < resolvedEnd)
+                continue;
+            size_t lineStart = match.lineStart == std::string::npos ? resolvedLineStart : match.lineStart;
+            matches.push_back({resolvedLines + (uint) match.lineFeedsBefore, (int) (match.offset - lineStart), match.offset});
+            resolvedEnd = match.offset + query.length();
+        }
+        resolvedLines += chunk.lineFeeds;
+        if (chunk.lastLineStart != std::string::npos)
+            resolvedLineStart = chunk.lastLineStart;
+        // Only the done flag is needed from here on
+        chunk.matches = std::vector<ChunkMatch>();
+        resolvedChunks++;
+    }
+    if (resolvedChunks == chunks.size())
+        done = true;
+}
+
+void Finder::appendRange(size_t begin, size_t end, PieceReader& reader, std::string& out) const {
+    size_t i = std::upper_bound(pieceStarts.begin(), pieceStarts.end(), begin) - pieceStarts.begin() - 1;
+    for (; begin < end; i++) {
+        size_t n = std::min(end, pieceStarts[i + 1]) - begin;
+        out.append(reader.read(i).data() + (begin - pieceStarts[i]), n);
+        begin += n;
+    }
+}
+
+void Finder::narrow(const std::string& longerQuery) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string_view rest = std::string_view(longerQuery).substr(query.length());
+    std::string text;
+    PieceReader reader(snapshot.get());
+    size_t kept = 0;
+    for (const Match& match : matches) {
+        size_t end = match.offset + longerQuery.length();
+        if (end > pieceStarts.back())
+            continue;
+        text.clear();
+        appendRange(match.offset + query.length(), end, reader, text);
+        if (text == rest)
+            matches[kept++] = match;
+    }
+    matches.resize(kept);
+    query = longerQuery;
+}
+
+void Finder::replaceAll(Buffer* b, std::string_view replacement) {
+    if (!done || matches.empty())
+        return;
+    // The text from the first match to the end of the last one is replaced
+    // as a whole, so that the buffer is only edited twice however many
+    // matches there are
+    const Match& first = matches.front();
+    size_t end = matches.back().offset + query.length();
+    std::string text;
+    PieceReader reader(snapshot.get());
+    size_t copied = first.offset;
+    for (const Match& match : matches) {
+        appendRange(copied, match.offset, reader, text);
+        text.append(replacement);
+        copied = match.offset + query.length();
+    }
+    b->history.beginGroup();
+    b->deleteRange(first.line, first.col, end - first.offset);
+    b->insertText(first.line, first.col, text);
+    b->history.endGroup();
+    trace("Finder | Replaced %zu matches", matches.size());
+    // Matches are out of date now
+    cancel();
+}
@@ -0,0 +1,113 @@
+/*
+ * Finder searches a snapshot of a buffer's text for a string on background
+ * threads. The text is split into chunks that worker threads take in order,
+ * scanning them with a vectorized matcher. Matches are streamed back as soon
+ * as every chunk before theirs is done (which is what their line numbers
+ * depend on), so the first ones show up long before a large file is fully
+ * scanned. Matches don't overlap, like when searching from left to right,
+ * unless overlapping ones are asked for.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Buffer.h"
+
+class Finder {
+    public:
+        struct Match {
+            uint line;
+            int col;
+            // Offset from the start of the text
+            size_t offset;
+        };
+
+        // Stops a search in progress
+        ~Finder();
+        // Starts searching a snapshot for `query`, stopping any previous search
+        void start(std::unique_ptr<Snapshot> snapshot, const std::string& query, bool overlapping = false);
+        // Stops the search and forgets its matches
+        void cancel();
+        // Whether all matches have been found
+        bool finished() const { return done; }
+        const std::string& getQuery() const { return query; }
+        // Appends matches found after the first `from` ones (in file order)
+        // to `out`. Returns the number of matches found so far.
+        size_t copyMatches(size_t from, std::vector<Match>* out);
+        // Replaces every match with `replacement` in one edit, which is also
+        // undone as one. The search must have finished, and the buffer must
+        // not have been edited since it was started.
+        void replaceAll(Buffer* b, std::string_view replacement);
+        // Narrows the matches of a finished overlapping search down to those
+        // of a query extending the searched one, by checking the snapshot's
+        // text after each match instead of searching again
+        void narrow(const std::string& longerQuery);
+    private:
+        // Match found by a worker, with its line relative to the chunk's
+        struct ChunkMatch {
+            size_t offset;
+            size_t lineFeedsBefore;
+            // Offset where the match's line starts, or npos if it starts in
+            // an earlier chunk
+            size_t lineStart;
+        };
+        struct ChunkResult {
+            std::vector<ChunkMatch> matches;
+            size_t lineFeeds = 0;
+            // Offset after the chunk's last line feed, or npos if it has none
+            size_t lastLineStart = std::string::npos;
+            bool done = false;
+        };
+
+        // Reads the snapshot's pieces for one thread. Keeps the last two
+        // compressed pieces it read decompressed, which is all a worker
+        // needs while it scans a piece and the start of the next one.
+        class PieceReader {
+            public:
+                PieceReader(const Snapshot* snapshot) : snapshot(snapshot) {}
+                std::string_view read(size_t i);
+            private:
+                const Snapshot* snapshot;
+                size_t pieces[2] = {SIZE_MAX, SIZE_MAX};
+                std::string_view views[2];
+                std::string texts[2];
+                // Slot read most recently
+                size_t last = 0;
+        };
+
+        std::unique_ptr<Snapshot> snapshot;
+        // Offset where each of the snapshot's pieces starts, and its size at the end
+        std::vector<size_t> pieceStarts;
+        std::string query;
+        bool overlapping = false;
+        std::vector<std::thread> workers;
+        std::atomic<size_t> nextChunk{0};
+        std::atomic<bool> cancelled{false};
+        std::atomic<bool> done{true};
+
+        // Guards the members below, which workers update as chunks finish
+        std::mutex mutex;
+        std::vector<ChunkResult> chunks;
+        std::vector<Match> matches;
+        // Chunks before this have had their matches added to `matches`
+        size_t resolvedChunks = 0;
+        // Line and line start offset at the start of the first unresolved chunk
+        uint resolvedLines = 0;
+        size_t resolvedLineStart = 0;
+        // End of the last match, since matches can't overlap
+        size_t resolvedEnd = 0;
+
+        // Takes chunks and scans them until there are none left
+        void work();
+        void scanChunk(size_t begin, size_t end, PieceReader& reader, ChunkResult* result);
+        // Adds the matches of chunks that are done and follow resolved ones
+        void resolveChunks();
+        // Appends text between offsets `begin` and `end` to `out`
+        void appendRange(size_t begin, size_t end, PieceReader& reader, std::string& out) const;
+};
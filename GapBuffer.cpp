@@ -0,0 +1,212 @@
+#include "GapBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+#include "FileLoader.h"
+#include "Trace.h"
+
+// Smallest gap created when the gap runs out
+const size_t MIN_GAP = 4096;
+
+GapBuffer::GapBuffer(char* filename) {
+    this->filename = filename;
+
+    // Read whole file (if it exists) straight into the array in memory
+    LoadedFile file = loadFile(filename);
+    fileMemory = std::move(file.text);
+    lineIndex.build(std::move(file.lineLengths));
+
+    // Gap starts out empty at the end of the text, and is created on first insert
+    gapStart = gapEnd = fileMemory.size();
+    trace("GapBuffer | Length is %zu bytes", fileMemory.size());
+}
+
+// Gets the start and end indices of a given line in the text, from the line
+// index. End is the index of the line's delimiter, or npos if it is the last
+// line. Begin is npos if there is no such line.
+void GapBuffer::getLineBounds(uint lineNum, size_t* beginP, size_t* endP) {
+    if (lineNum >= lineIndex.lineCount()) {
+        *beginP = std::string::npos;
+        *endP = std::string::npos;
+        return;
+    }
+    *beginP = lineIndex.lineStart(lineNum);
+    if (lineNum + 1 < lineIndex.lineCount())
+        *endP = *beginP + lineIndex.lineLength(lineNum) - 1;
+    else
+        *endP = std::string::npos;
+}
+
+void GapBuffer::moveGap(size_t pos) {
+    if (pos == gapStart)
+        return;
+    size_t moved;
+    if (pos < gapStart) {
+        // Shift text between pos and the gap to after the gap
+        moved = gapStart - pos;
+        memmove(&fileMemory[gapEnd - moved], &fileMemory[pos], moved);
+        gapEnd -= moved;
+    } else {
+        // Shift text between the gap and pos to before the gap
+        moved = pos - gapStart;
+        memmove(&fileMemory[gapStart], &fileMemory[gapEnd], moved);
+        gapEnd += moved;
+    }
+    trace("GapBuffer | Moved gap from %zu to %zu (%zu bytes)", gapStart, pos, moved);
+    gapStart = pos;
+}
+
+void GapBuffer::growGap(size_t needed) {
+    size_t length = textLength();
+    size_t gap = std::max({MIN_GAP, length / 2, needed});
+    std::string grown(length + gap, '\0');
+    std::copy(fileMemory.begin(), fileMemory.begin() + gapStart, grown.begin());
+    std::copy(fileMemory.begin() + gapEnd, fileMemory.end(), grown.begin() + gapStart + gap);
+    fileMemory.swap(grown);
+    gapEnd = gapStart + gap;
+    trace("GapBuffer | Grew gap to %zu bytes (%zu bytes copied)", gap, length);
+}
+
+std::string_view GapBuffer::textRange(size_t begin, size_t end) {
+    std::string_view memory = fileMemory;
+    size_t gap = gapEnd - gapStart;
+    if (end <= gapStart)
+        return memory.substr(begin, end - begin);
+    if (begin >= gapStart)
+        return memory.substr(begin + gap, end - begin);
+    // Range is split by the gap
+    lineScratch.assign(memory.substr(begin, gapStart - begin));
+    lineScratch.append(memory.substr(gapEnd, end - gapStart));
+    return lineScratch;
+}
+
+std::optional<std::string> GapBuffer::getLine(uint lineNum) {
+    size_t begin, end;
+    getLineBounds(lineNum, &begin, &end);
+    if (begin == std::string::npos)
+        return {};
+    end = end == std::string::npos ? textLength() : end + 1;
+    return std::string(textRange(begin, end));
+}
+
+uint GapBuffer::visitLines(uint firstLine, uint count, const LineVisitor& visitor) {
+    if (firstLine >= lineIndex.lineCount())
+        return 0;
+    size_t begin = lineIndex.lineStart(firstLine);
+    uint visited = 0;
+    for (uint line = firstLine; visited < count && line < lineIndex.lineCount(); line++, visited++) {
+        size_t length = lineIndex.lineLength(line);
+        visitor(line, textRange(begin, begin + length));
+        begin += length;
+    }
+    return visited;
+}
+
+uint GapBuffer::visitLineSlices(uint firstLine, uint count, size_t fromCol, size_t width, const SliceVisitor& visitor) {
+    if (firstLine >= lineIndex.lineCount())
+        return 0;
+    size_t begin = lineIndex.lineStart(firstLine);
+    uint visited = 0;
+    for (uint line = firstLine; visited < count && line < lineIndex.lineCount(); line++, visited++) {
+        size_t length = lineIndex.lineLength(line);
+        bool hasNewline = line + 1 < lineIndex.lineCount();
+        size_t textLength = length - hasNewline;
+        size_t from = std::min(fromCol, textLength);
+        size_t to = from + std::min(width, textLength - from);
+        visitor(line, {textRange(begin + from, begin + to), textLength, hasNewline});
+        begin += length;
+    }
+    return visited;
+}
+
+uint GapBuffer::lineCount() {
+    return lineIndex.lineCount();
+}
+
+// Copies the text on either side of the gap
+std::unique_ptr<Snapshot> GapBuffer::snapshot() {
+    auto text = std::make_shared<std::string>();
+    text->reserve(textLength());
+    text->append(fileMemory, 0, gapStart);
+    text->append(fileMemory, gapEnd, std::string::npos);
+    auto snapshot = std::make_unique<Snapshot>();
+    snapshot->pieces.push_back(*text);
+    snapshot->owned.push_back(text);
+    return snapshot;
+}
+
+void GapBuffer::applyDelChar(int line, int col) {
+    // Get bound indices of line to edit
+    size_t begin, end;
+    getLineBounds(line, &begin, &end);
+    // No effect if out of range
+    if (begin == std::string::npos || col > end - begin || begin + col >= textLength())
+        return;
+    size_t charPos = begin + col;
+    // Deleting a delimiter joins the line with the next one
+    if (charAt(charPos) == '\n')
+        lineIndex.joinLines(line);
+    else
+        lineIndex.adjustLine(line, -1);
+    // Deleting just before the gap (backspace) or just after it (delete)
+    // only widens the gap. Anywhere else, the gap moves there first.
+    if (charPos + 1 == gapStart) {
+        gapStart--;
+    } else {
+        moveGap(charPos);
+        gapEnd++;
+    }
+}
+
+void GapBuffer::applyInsertChar(char c, int line, int col) {
+    // Get bound indices of line to edit
+    size_t begin, end;
+    getLineBounds(line, &begin, &end);
+    // No effect if out of range
+    if (begin == std::string::npos || col > end - begin || begin + col > textLength())
+        return;
+    // Insert character into the gap at the insertion point
+    moveGap(begin + col);
+    if (gapStart == gapEnd)
+        growGap(1);
+    fileMemory[gapStart++] = c;
+    if (c == '\n')
+        lineIndex.splitLine(line, col);
+    else
+        lineIndex.adjustLine(line, 1);
+}
+
+void GapBuffer::applyInsertText(int line, int col, std::string_view text) {
+    // Get bound indices of line to edit
+    size_t begin, end;
+    getLineBounds(line, &begin, &end);
+    // No effect if out of range
+    if (begin == std::string::npos || col < 0 || col > end - begin || begin + col > textLength())
+        return;
+    // Copy text into the gap at the insertion point, growing it to fit
+    moveGap(begin + col);
+    if (gapEnd - gapStart < text.length())
+        growGap(text.length());
+    memcpy(&fileMemory[gapStart], text.data(), text.length());
+    gapStart += text.length();
+    lineIndex.insertText(line, col, text);
+}
+
+void GapBuffer::applyDeleteRange(int line, int col, size_t count) {
+    // Get bound indices of line to edit
+    size_t begin, end;
+    getLineBounds(line, &begin, &end);
+    // No effect if out of range
+    if (begin == std::string::npos || col < 0 || col > end - begin || begin + col >= textLength())
+        return;
+    size_t charPos = begin + col;
+    count = std::min(count, textLength() - charPos);
+    lineIndex.deleteText(line, col, count);
+    // Deleted text is absorbed into the gap
+    if (charPos + count == gapStart) {
+        gapStart -= count;
+    } else {
+        moveGap(charPos);
+        gapEnd += count;
+    }
+}
@@ -0,0 +1,51 @@
+/*
+ * GapBuffer stores the text as a contiguous array with a gap of unused space
+ * kept at the last edit position. Consecutive inserts and deletes at the
+ * cursor only move the gap's edges, and text is only shifted when an edit
+ * happens somewhere else (moving the gap there) or the gap runs out.
+ */
+
+#pragma once
+
+#include <vector>
+#include "Buffer.h"
+#include "LineIndex.h"
+
+class GapBuffer : public Buffer {
+    public:
+        GapBuffer(char* filename);
+        std::optional<std::string> getLine(uint lineNum);
+        uint visitLines(uint firstLine, uint count, const LineVisitor& visitor);
+        uint visitLineSlices(uint firstLine, uint count, size_t fromCol, size_t width, const SliceVisitor& visitor);
+        uint lineCount();
+        std::unique_ptr<Snapshot> snapshot();
+    protected:
+        void applyDelChar(int line, int col);
+        void applyInsertChar(char c, int line, int col);
+        void applyInsertText(int line, int col, std::string_view text);
+        void applyDeleteRange(int line, int col, size_t count);
+    private:
+        // Text before the gap is at [0, gapStart), text after it at [gapEnd, size)
+        std::string fileMemory;
+        size_t gapStart = 0;
+        size_t gapEnd = 0;
+        // Start offsets of lines in the text (excluding the gap)
+        LineIndex lineIndex;
+        // Holds lines split by the gap while they are visited. Reused so that
+        // visiting lines doesn't allocate.
+        std::string lineScratch;
+
+        size_t textLength() const { return fileMemory.size() - (gapEnd - gapStart); }
+        // Char at an offset in the text, skipping over the gap
+        char charAt(size_t pos) const { return fileMemory[pos < gapStart ? pos : pos + gapEnd - gapStart]; }
+        // Gets the start and end indices of a given line in the text,
+        // like ArrayBuffer::getLineBounds.
+        void getLineBounds(uint lineNum, size_t* beginP, size_t* endP);
+        // Text between offsets `begin` and `end`, copied into lineScratch
+        // if it is split by the gap
+        std::string_view textRange(size_t begin, size_t end);
+        // Moves the gap so that it starts at text offset `pos`
+        void moveGap(size_t pos);
+        // Reallocates the array with a larger gap, of at least `needed` bytes
+        void growGap(size_t needed);
+};
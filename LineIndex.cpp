@@ -0,0 +1,113 @@
+#include "LineIndex.h"
+
+#include <algorithm>
+#include <cstring>
+
+void LineIndex::build(std::vector<size_t> lineLengths) {
+    lengths = std::move(lineLengths);
+    if (lengths.empty())
+        lengths.push_back(0);
+    rebuild();
+}
+
+// Builds the Fenwick tree from `lengths` in O(n), by adding each node
+// into the next node whose range covers it. Nodes before `from` only cover
+// lines before it, so they are kept, and those of them covering a maximal
+// part of the lines before it are added into their parents past it.
+void LineIndex::rebuild(size_t from) {
+    tree.resize(lengths.size());
+    std::copy(lengths.begin() + from, lengths.end(), tree.begin() + from);
+    for (size_t i = from; i > 0; i &= i - 1) {
+        size_t parent = (i - 1) | i;
+        if (parent < tree.size())
+            tree[parent] += tree[i - 1];
+    }
+    for (size_t i = from; i < tree.size(); i++) {
+        size_t parent = i | (i + 1);
+        if (parent < tree.size())
+            tree[parent] += tree[i];
+    }
+}
+
+size_t LineIndex::lineStart(size_t lineNum) const {
+    // Sum of lengths of all lines before this one
+    size_t sum = 0;
+    for (size_t i = lineNum; i > 0; i &= i - 1)
+        sum += tree[i - 1];
+    return sum;
+}
+
+size_t LineIndex::lineAt(size_t offset) const {
+    // Descend the implicit tree to find the last line starting at or before offset
+    size_t pos = 0;
+    size_t step = 1;
+    while (step * 2 <= tree.size())
+        step *= 2;
+    for (; step > 0; step /= 2) {
+        if (pos + step <= tree.size() && tree[pos + step - 1] <= offset) {
+            pos += step;
+            offset -= tree[pos - 1];
+        }
+    }
+    return pos < lengths.size() ? pos : lengths.size() - 1;
+}
+
+void LineIndex::adjustLine(size_t lineNum, long delta) {
+    lengths[lineNum] += delta;
+    for (size_t i = lineNum; i < tree.size(); i |= i + 1)
+        tree[i] += delta;
+}
+
+void LineIndex::splitLine(size_t lineNum, size_t col) {
+    // Line keeps text before the line feed plus the new line feed,
+    // and the rest of the line moves into a new line after it.
+    size_t rest = lengths[lineNum] - col;
+    lengths[lineNum] = col + 1;
+    lengths.insert(lengths.begin() + lineNum + 1, rest);
+    rebuild(lineNum);
+}
+
+void LineIndex::joinLines(size_t lineNum) {
+    lengths[lineNum] += lengths[lineNum + 1] - 1;
+    lengths.erase(lengths.begin() + lineNum + 1);
+    rebuild(lineNum);
+}
+
+void LineIndex::insertText(size_t lineNum, size_t col, std::string_view text) {
+    // Lengths of the lines the text is split into by its line feeds
+    std::vector<size_t> inserted;
+    size_t start = 0;
+    const char* end = text.data() + text.length();
+    for (const char* p = text.data(); (p = (const char*) memchr(p, '\n', end - p)); p++) {
+        inserted.push_back(p - text.data() + 1 - start);
+        start = p - text.data() + 1;
+    }
+    if (inserted.empty()) {
+        adjustLine(lineNum, text.length());
+        return;
+    }
+    // First line keeps the text before the insertion point, and the
+    // rest of the line moves to the end of the last inserted line.
+    inserted.front() += col;
+    inserted.push_back(text.length() - start + lengths[lineNum] - col);
+    lengths[lineNum] = inserted.front();
+    lengths.insert(lengths.begin() + lineNum + 1, inserted.begin() + 1, inserted.end());
+    rebuild(lineNum);
+}
+
+void LineIndex::deleteText(size_t lineNum, size_t col, size_t count) {
+    // Find the line and column where the deleted text ends
+    size_t endLine = lineNum;
+    size_t endCol = col + count;
+    while (endLine + 1 < lengths.size() && endCol >= lengths[endLine]) {
+        endCol -= lengths[endLine];
+        endLine++;
+    }
+    if (endLine == lineNum) {
+        adjustLine(lineNum, -(long) count);
+        return;
+    }
+    lengths[lineNum] = col + lengths[endLine] - endCol;
+    lengths.erase(lengths.begin() + lineNum + 1, lengths.begin() + endLine + 1);
+    rebuild(lineNum);
+}
@@ -0,0 +1,49 @@
+/*
+ * LineIndex maps line numbers to byte offsets for buffers that keep their
+ * text contiguous rather than as separate lines. The length of every line
+ * (including its line feed) is kept in a Fenwick tree, so finding where a
+ * line starts is an O(log n) prefix sum instead of counting delimiters, and
+ * edits within a line are O(log n) updates.
+ * Adding or removing lines shifts the lines after them, so the tree is
+ * rebuilt from the edited line on, which is O(lines after it) like moving
+ * the lengths themselves.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+class LineIndex {
+    public:
+        // Builds the index from the lengths of all lines in the text. There is
+        // always one more line than line feeds (the last may be empty).
+        void build(std::vector<size_t> lineLengths);
+        size_t lineCount() const { return lengths.size(); }
+        // Offset of the first character of a line
+        size_t lineStart(size_t lineNum) const;
+        // Length of a line, including its line feed if it has one
+        size_t lineLength(size_t lineNum) const { return lengths[lineNum]; }
+        // Line containing the char at `offset`, or the last line if past the end
+        size_t lineAt(size_t offset) const;
+
+        // A char other than a line feed was inserted (+1) or deleted (-1) in a line
+        void adjustLine(size_t lineNum, long delta);
+        // A line feed was inserted `col` bytes into a line, splitting it in two
+        void splitLine(size_t lineNum, size_t col);
+        // The line feed ending a line was deleted, joining it with the next line
+        void joinLines(size_t lineNum);
+        // Text was inserted `col` bytes into a line, splitting it at every line feed
+        void insertText(size_t lineNum, size_t col, std::string_view text);
+        // `count` bytes were deleted from `col` bytes into a line, joining it
+        // with the following lines whose line feeds were deleted
+        void deleteText(size_t lineNum, size_t col, size_t count);
+    private:
+        std::vector<size_t> lengths;
+        // Fenwick (binary indexed) tree over `lengths`
+        std::vector<size_t> tree;
+        // Rebuilds the tree for the lines from `from` on, after their
+        // lengths changed or they moved
+        void rebuild(size_t from = 0);
+};
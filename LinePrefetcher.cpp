@@ -0,0 +1,224 @@
+#include "LinePrefetcher.h"
+
+#include <algorithm>
+#include "Trace.h"
+
+// Pages of lines prefetched ahead of the view in the direction it scrolled.
+// One page is kept on the other side, for scrolling back.
+const uint PAGES_AHEAD = 2;
+// Lines read at a time, between which the editor can take the buffer back
+const uint BATCH_LINES = 16;
+
+LinePrefetcher::LinePrefetcher(Buffer* b) : buffer(b) {
+    buffer->addEditListener([this](uint line, uint linesRemoved, uint linesAdded) {
+        onEdit(line, linesRemoved, linesAdded);
+    });
+    thread = std::thread(&LinePrefetcher::run, this);
+}
+
+LinePrefetcher::~LinePrefetcher() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    thread.join();
+}
+
+uint LinePrefetcher::visitLineSlices(uint firstLine, uint count, size_t fromCol, size_t width, const SliceVisitor& visitor) {
+    TraceTimer timer(TraceOp::GetLine);
+    setColumns(fromCol, width);
+    uint end = firstLine + count;
+    uint line = firstLine;
+    while (line < end && line < endLine) {
+        if (const CachedLine* cached = find(line)) {
+            visitor(line, {cached->text, cached->length, cached->hasNewline});
+            line++;
+            continue;
+        }
+        // Read the lines up to the next cached one as one range, straight
+        // from the buffer. The helper caches them once the editor waits.
+        uint missing = 1;
+        while (line + missing < end && !find(line + missing))
+            missing++;
+        uint visited = buffer->visitLineSlices(line, missing, fromCol, width, visitor);
+        line += visited;
+        if (visited < missing) {
+            endLine = line;
+            break;
+        }
+    }
+    return line - firstLine;
+}
+
+void LinePrefetcher::setView(uint firstLine, uint rows, size_t fromCol, size_t width) {
+    setColumns(fromCol, width);
+    if (firstLine != viewLine)
+        scrollingDown = firstLine > viewLine;
+    viewLine = firstLine;
+    viewRows = rows;
+    // Enough slots for the lines worth keeping whichever way the view
+    // scrolled. They only grow, so that resizing back and forth doesn't
+    // allocate again.
+    uint count = rows * (PAGES_AHEAD + 2);
+    if (count != slotCount) {
+        if (slots.size() < count)
+            slots.resize(count);
+        for (CachedLine& slot : slots)
+            slot.line = NO_LINE;
+        slotCount = count;
+    }
+    drop();
+}
+
+void LinePrefetcher::release() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        released = true;
+    }
+    wake.notify_one();
+}
+
+void LinePrefetcher::acquire() {
+    // The helper checks this before each batch, so it only has to finish
+    // the one it is on
+    released = false;
+    std::lock_guard<std::mutex> lock(mutex);
+}
+
+const LinePrefetcher::CachedLine* LinePrefetcher::find(uint line) const {
+    if (slotCount == 0)
+        return nullptr;
+    const CachedLine& slot = slots[line % slotCount];
+    return slot.line == line ? &slot : nullptr;
+}
+
+void LinePrefetcher::setColumns(size_t fromCol, size_t width) {
+    if (fromCol == cacheCol && width == cacheWidth)
+        return;
+    for (CachedLine& slot : slots)
+        slot.line = NO_LINE;
+    cacheCol = fromCol;
+    cacheWidth = width;
+}
+
+uint LinePrefetcher::keepBegin() const {
+    uint behind = viewRows * (scrollingDown ? 1 : PAGES_AHEAD);
+    return viewLine - std::min(viewLine, behind);
+}
+
+uint LinePrefetcher::keepEnd() const {
+    uint ahead = viewRows * (scrollingDown ? PAGES_AHEAD : 1);
+    return std::min(endLine, viewLine + viewRows + ahead);
+}
+
+void LinePrefetcher::drop(uint first, uint last) {
+    uint begin = keepBegin();
+    uint end = keepEnd();
+    for (uint i = 0; i < slotCount; i++) {
+        uint line = slots[i].line;
+        if (line != NO_LINE && (line < begin || line >= end || (line >= first && line <= last)))
+            slots[i].line = NO_LINE;
+    }
+}
+
+bool LinePrefetcher::nextMissing(uint* first, uint* count) const {
+    uint begin = keepBegin();
+    uint end = keepEnd();
+    // Looks downwards from `from` for a missing line, and takes the run of
+    // missing lines after it
+    auto findBelow = [&](uint from) {
+        for (uint line = from; line < end; line++) {
+            if (find(line))
+                continue;
+            *first = line;
+            *count = 1;
+            while (*count < BATCH_LINES && line + *count < end && !find(line + *count))
+                (*count)++;
+            return true;
+        }
+        return false;
+    };
+    // Looks upwards from `from` (exclusive) for a missing line, and takes
+    // the run of missing lines before it
+    auto findAbove = [&](uint from) {
+        for (uint line = std::min(from, end); line > begin; line--) {
+            if (find(line - 1))
+                continue;
+            *count = 1;
+            while (*count < BATCH_LINES && line - *count > begin && !find(line - 1 - *count))
+                (*count)++;
+            *first = line - *count;
+            return true;
+        }
+        return false;
+    };
+    if (scrollingDown)
+        return findBelow(viewLine) || findAbove(viewLine);
+    return findAbove(viewLine + viewRows) || findBelow(viewLine + viewRows);
+}
+
+void LinePrefetcher::fetch(uint firstLine, uint count) {
+    uint visited = buffer->visitLineSlices(firstLine, count, cacheCol, cacheWidth,
+        [this](uint lineNum, const LineSlice& slice) {
+            CachedLine& slot = slots[lineNum % slotCount];
+            slot.line = lineNum;
+            // Reuses the string's memory
+            slot.text.assign(slice.text);
+            slot.length = slice.length;
+            slot.hasNewline = slice.hasNewline;
+        });
+    if (visited < count)
+        endLine = firstLine + visited;
+}
+
+void LinePrefetcher::onEdit(uint line, uint linesRemoved, uint linesAdded) {
+    // Lines from the edited one to the last one it removed changed. Typing
+    // within a line stops there.
+    endLine = UINT_MAX;
+    drop(line, line + linesRemoved);
+    if (linesAdded == linesRemoved)
+        return;
+    // The lines after them moved, so their slots are swapped into the ones
+    // of their new line numbers. Every cached line is within the range
+    // worth keeping, which is no longer than the ring, so the slot a line
+    // moves to is empty or holds a line that moves too. Those are moved
+    // first, by going against the direction lines move in.
+    long shift = (long) linesAdded - (long) linesRemoved;
+    uint begin = keepBegin();
+    uint end = keepEnd();
+    uint from = std::max(begin, line + linesRemoved + 1);
+    auto move = [&](uint old) {
+        CachedLine& slot = slots[old % slotCount];
+        if (slot.line != old)
+            return;
+        slot.line = NO_LINE;
+        long moved = (long) old + shift;
+        if (moved < (long) begin || moved >= (long) end)
+            return;
+        CachedLine& target = slots[moved % slotCount];
+        std::swap(target, slot);
+        target.line = moved;
+    };
+    if (shift > 0) {
+        for (uint old = end; old-- > from;)
+            move(old);
+    } else {
+        for (uint old = from; old < end; old++)
+            move(old);
+    }
+}
+
+void LinePrefetcher::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    uint first, count;
+    while (true) {
+        wake.wait(lock, [&]() { return stopping || (released && nextMissing(&first, &count)); });
+        if (stopping)
+            return;
+        fetch(first, count);
+        // Let acquire() take the mutex between batches
+        lock.unlock();
+        lock.lock();
+    }
+}
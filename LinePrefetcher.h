@@ -0,0 +1,95 @@
+/*
+ * LinePrefetcher keeps a cache of the lines around the editor's view, as the
+ * part of each line that is shown, and fills it on a helper thread while the
+ * editor waits for keys. Lines further ahead in the direction the view last
+ * scrolled are read first, so that scrolling and paging draw lines from
+ * memory instead of looking each one up in the buffer as it comes into view.
+ * Lines are kept in a ring of slots indexed by line number, whose strings
+ * are reused, so that neither filling the cache nor drawing from it
+ * allocates once the slots have grown to the width of the view. Lines the
+ * editor reads itself are drawn straight from the buffer without copying.
+ *
+ * Buffers aren't thread-safe, so the helper only reads from the buffer (and
+ * the cache) between release() and acquire(), while the editor doesn't.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Buffer.h"
+
+class LinePrefetcher {
+    public:
+        // Starts the helper thread, which waits until the buffer is released
+        LinePrefetcher(Buffer* b);
+        ~LinePrefetcher();
+        // Like Buffer::visitLineSlices, but visits cached lines from memory.
+        // Lines that aren't cached are visited from the buffer.
+        uint visitLineSlices(uint firstLine, uint count, size_t fromCol, size_t width, const SliceVisitor& visitor);
+        // Sets the view to prefetch around: `rows` lines from `firstLine`,
+        // showing `width` chars of each from column `fromCol`. Cached lines
+        // too far from the view are dropped.
+        void setView(uint firstLine, uint rows, size_t fromCol, size_t width);
+        // Lets the helper read lines from the buffer until acquire() is called.
+        // The buffer must not be used in between.
+        void release();
+        // Stops the helper, waiting for it to finish the lines it is reading
+        void acquire();
+    private:
+        static constexpr uint NO_LINE = UINT_MAX;
+        struct CachedLine {
+            // Line held, or NO_LINE if the slot is empty
+            uint line = NO_LINE;
+            std::string text;
+            size_t length = 0;
+            bool hasNewline = false;
+        };
+
+        Buffer* buffer;
+        std::thread thread;
+        // Held by the helper while it reads lines. Everything below is only
+        // used by the editor while the buffer is acquired, and by the helper
+        // while it holds the mutex and the buffer is released.
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::atomic<bool> released{false};
+        bool stopping = false;
+        // Line n is kept in slot n % slotCount, which holds every line worth
+        // keeping without two of them sharing a slot. Slots past slotCount
+        // are left from a taller view, and unused.
+        std::vector<CachedLine> slots;
+        uint slotCount = 0;
+        size_t cacheCol = 0;
+        size_t cacheWidth = 0;
+        // Lines from here on don't exist, as far as is known
+        uint endLine = UINT_MAX;
+        // View to prefetch around, and whether it last scrolled down
+        uint viewLine = 0;
+        uint viewRows = 0;
+        bool scrollingDown = true;
+
+        // Cached line, or null if it isn't cached
+        const CachedLine* find(uint line) const;
+        // Drops cached lines if the columns they were cut to changed
+        void setColumns(size_t fromCol, size_t width);
+        // Range of lines worth keeping, around the view
+        uint keepBegin() const;
+        uint keepEnd() const;
+        // Empties the slots of lines outside that range, and of those from
+        // `first` to `last`
+        void drop(uint first = NO_LINE, uint last = NO_LINE);
+        // Finds the next run of lines to read, nearest to the view first in
+        // the direction it scrolled. Returns false if all of them are cached.
+        bool nextMissing(uint* first, uint* count) const;
+        // Reads lines from the buffer into the cache
+        void fetch(uint firstLine, uint count);
+        // Updates the cache after an edit (see EditListener)
+        void onEdit(uint line, uint linesRemoved, uint linesAdded);
+        void run();
+};
@@ -0,0 +1,71 @@
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+void MappedFile::read(const std::string& filename) {
+    std::ifstream fileStream(filename, std::ios::binary);
+    if (!fileStream.is_open())
+        return;
+    // Read in one go, the file may be large
+    fileStream.seekg(0, std::ios::end);
+    contents.resize(std::max<std::streamoff>(0, fileStream.tellg()));
+    fileStream.seekg(0);
+    fileStream.read(&contents[0], contents.length());
+    contents.resize(fileStream.gcount());
+    mapping = contents.data();
+    length = contents.length();
+    opened = true;
+}
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& filename, bool) {
+    read(filename);
+}
+
+MappedFile::~MappedFile() {}
+
+#else
+
+MappedFile::MappedFile(const std::string& filename, bool map) {
+    if (!map) {
+        read(filename);
+        return;
+    }
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return;
+    }
+    opened = true;
+    length = st.st_size;
+    // mmap() rejects zero-length mappings, an empty file simply has no data
+    if (length > 0) {
+        void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            throw std::string("Unable to map file: ") + filename;
+        }
+        mapping = static_cast<const char*>(p);
+    }
+    // The mapping keeps its own reference to the file, fd no longer needed
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (isMapped())
+        munmap(const_cast<char*>(mapping), length);
+}
+
+#endif
@@ -0,0 +1,36 @@
+/*
+ * MappedFile is a read-only view of a file's contents. On POSIX systems the
+ * file is memory-mapped, so opening is near-instant and pages are only read
+ * from disk when they are first accessed. On Windows it falls back to reading
+ * the file into memory, and so does a file that may be cut short while it is
+ * open, since reading a mapping past the file's new end faults.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+class MappedFile {
+    public:
+        // Reads the file into memory instead of mapping it if not `map`
+        MappedFile(const std::string& filename, bool map = true);
+        ~MappedFile();
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        // Whether the file existed and could be opened for reading
+        bool isOpen() const { return opened; }
+        // Whether the data is mapped from the file rather than read from it
+        bool isMapped() const { return mapping && mapping != contents.data(); }
+        const char* data() const { return mapping; }
+        size_t size() const { return length; }
+    private:
+        const char* mapping = nullptr;
+        size_t length = 0;
+        bool opened = false;
+        // Backing memory when the file isn't mapped
+        std::string contents;
+
+        void read(const std::string& filename);
+};
@@ -0,0 +1,136 @@
+#include "MatchIndex.h"
+
+#include <algorithm>
+#include "Utils.h"
+
+// Orders matches by position
+static bool isBefore(const Finder::Match& match, std::pair<uint, int> pos) {
+    return std::make_pair(match.line, match.col) < pos;
+}
+
+static bool isEarlier(const Finder::Match& a, const Finder::Match& b) {
+    return isBefore(a, std::make_pair(b.line, b.col));
+}
+
+MatchIndex::MatchIndex(Buffer* b) : b(b) {
+    b->addEditListener([this](uint line, uint linesRemoved, uint linesAdded) {
+        onEdit(line, linesRemoved, linesAdded);
+    });
+}
+
+void MatchIndex::setQuery(const std::string& newQuery) {
+    bool extends = !query.empty() && newQuery.length() > query.length()
+        && newQuery.compare(0, query.length(), query) == 0;
+    query = newQuery;
+    if (query.empty()) {
+        finder.cancel();
+        matches.clear();
+        searching = false;
+    } else if (extends && !searching && !edited) {
+        // The finder's snapshot still has the same text as the buffer
+        finder.narrow(query);
+        matches.clear();
+        finder.copyMatches(0, &matches);
+    } else if (extends && !searching) {
+        narrowFromBuffer(query);
+    } else {
+        startSearch();
+    }
+}
+
+void MatchIndex::startSearch() {
+    finder.start(b->snapshot(), query, true);
+    matches.clear();
+    edits.clear();
+    collected = 0;
+    searching = true;
+    edited = false;
+}
+
+bool MatchIndex::update() {
+    if (!searching)
+        return false;
+    // Checked first, so that no matches are missed if it finishes meanwhile
+    bool finished = finder.finished();
+    size_t found = matches.size();
+    collected = finder.copyMatches(collected, &matches);
+    if (!edits.empty()) {
+        size_t kept = found;
+        for (size_t i = found; i < matches.size(); i++) {
+            if (followEdits(&matches[i]))
+                matches[kept++] = matches[i];
+        }
+        matches.resize(kept);
+        // Edited lines searched again may be after the new matches
+        if (found > 0 && kept > found && isEarlier(matches[found], matches[found - 1]))
+            std::inplace_merge(matches.begin(), matches.begin() + found, matches.end(), isEarlier);
+    }
+    if (finished)
+        searching = false;
+    return finished || matches.size() > found;
+}
+
+bool MatchIndex::followEdits(Finder::Match* match) const {
+    for (const Edit& edit : edits) {
+        if (match->line < edit.line)
+            continue;
+        if (match->line <= edit.line + edit.linesRemoved)
+            return false;
+        match->line = match->line - edit.linesRemoved + edit.linesAdded;
+    }
+    return true;
+}
+
+size_t MatchIndex::firstMatchFrom(uint line, int col) const {
+    return std::lower_bound(matches.begin(), matches.end(), std::make_pair(line, col), isBefore) - matches.begin();
+}
+
+void MatchIndex::onEdit(uint line, uint linesRemoved, uint linesAdded) {
+    if (query.empty())
+        return;
+    if (searching) {
+        // Typing within a line repeats the same edit, which only has to be
+        // followed once
+        bool repeated = !edits.empty() && edits.back().line == line && linesRemoved == 0 && linesAdded == 0
+            && edits.back().linesRemoved == 0 && edits.back().linesAdded == 0;
+        if (!repeated)
+            edits.push_back({line, linesRemoved, linesAdded});
+    }
+    edited = true;
+    // Drop matches on the edited lines and move the ones after them
+    auto first = std::lower_bound(matches.begin(), matches.end(), std::make_pair(line, 0), isBefore);
+    auto last = std::lower_bound(first, matches.end(), std::make_pair(line + linesRemoved + 1, 0), isBefore);
+    first = matches.erase(first, last);
+    for (auto it = first; it != matches.end(); ++it)
+        it->line = it->line - linesRemoved + linesAdded;
+    searchLines(line, linesAdded + 1);
+}
+
+void MatchIndex::searchLines(uint first, uint count) {
+    std::vector<Finder::Match> found;
+    b->visitLines(first, count, [&](uint lineNum, std::string_view line) {
+        for (size_t pos = line.find(query); pos != std::string_view::npos; pos = line.find(query, pos + 1))
+            found.push_back({lineNum, (int) pos, std::string::npos});
+    });
+    auto at = std::lower_bound(matches.begin(), matches.end(), std::make_pair(first, 0), isBefore);
+    matches.insert(at, found.begin(), found.end());
+}
+
+void MatchIndex::narrowFromBuffer(const std::string& longerQuery) {
+    size_t kept = 0;
+    for (size_t i = 0; i < matches.size();) {
+        // Visit each line once for all of its matches
+        uint lineNum = matches[i].line;
+        size_t end = i;
+        while (end < matches.size() && matches[end].line == lineNum)
+            end++;
+        b->visitLines(lineNum, 1, [&](uint, std::string_view line) {
+            for (size_t j = i; j < end; j++) {
+                if (line.compare(matches[j].col, longerQuery.length(), longerQuery) == 0)
+                    matches[kept++] = matches[j];
+            }
+        });
+        i = end;
+    }
+    matches.resize(kept);
+}
@@ -0,0 +1,72 @@
+/*
+ * MatchIndex keeps every occurrence (including overlapping ones) of a search
+ * query in a buffer, for searching as the query is typed. They are first
+ * found by a background Finder. After that, a query extending the previous
+ * one only narrows down the occurrences already found instead of searching
+ * the whole file again, and edits only make the lines they touch be searched
+ * again. That is so even while the background search is running, as the
+ * matches it finds later are moved past the edits made since its snapshot
+ * was taken, instead of taking a new snapshot for each edit. Queries can't
+ * contain line feeds, so matches are within one line.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Buffer.h"
+#include "Finder.h"
+
+class MatchIndex {
+    public:
+        // Listens to the buffer's edits, so the index must outlive any
+        // edits made to it
+        MatchIndex(Buffer* b);
+        // Changes the query, narrowing down the matches if it extends the
+        // previous one, or starting a new search otherwise. Clears the
+        // matches if empty.
+        void setQuery(const std::string& query);
+        const std::string& getQuery() const { return query; }
+        // Collects matches found by the background search since the last
+        // call. Returns whether there were any, or the search finished.
+        bool update();
+        // Whether all matches are known
+        bool complete() const { return !searching; }
+        // Matches in order. Their offsets are only set for matches found by
+        // the Finder, and out of date once the buffer has been edited.
+        const std::vector<Finder::Match>& getMatches() const { return matches; }
+        // Index of the first match at or after (line, col)
+        size_t firstMatchFrom(uint line, int col) const;
+    private:
+        Buffer* b;
+        Finder finder;
+        std::string query;
+        std::vector<Finder::Match> matches;
+        // Whether the finder is still searching
+        bool searching = false;
+        // Whether the buffer was edited since the finder's snapshot was taken
+        bool edited = false;
+        struct Edit {
+            uint line;
+            uint linesRemoved;
+            uint linesAdded;
+        };
+        // Edits made while the finder is searching, which its matches
+        // are moved past as they are collected
+        std::vector<Edit> edits;
+        // Number of the finder's matches collected so far
+        size_t collected = 0;
+
+        void startSearch();
+        void onEdit(uint line, uint linesRemoved, uint linesAdded);
+        // Moves a match found in the finder's snapshot to its line in the
+        // buffer. Returns false if its line was edited, in which case the
+        // line was searched again when it was.
+        bool followEdits(Finder::Match* match) const;
+        // Adds the matches in `count` lines starting from `first`, which
+        // must not have any yet
+        void searchLines(uint first, uint count);
+        // Keeps only the matches that are also matches of `longerQuery`,
+        // reading the text at each from the buffer
+        void narrowFromBuffer(const std::string& longerQuery);
+};
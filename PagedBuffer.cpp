@@ -0,0 +1,243 @@
+#include "PagedBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+#include "Trace.h"
+
+// Pages are large enough that reading one is mostly transfer rather than
+// seeking, and small enough that a screenful of lines rarely needs more than one
+const size_t PAGE_SIZE = 1 << 20;
+// Lines between checkpoints, which are read through to find a line
+const uint CHECKPOINT_LINES = 1024;
+// How much the background scan reads at a time
+const size_t SCAN_BLOCK = 4 << 20;
+
+PagedBuffer::PagedBuffer(char* filename, bool mapSnapshots) : mapSnapshots(mapSnapshots) {
+    this->filename = filename;
+    if (!open())
+        throw std::string("Unable to open file: ") + filename;
+    trace("PagedBuffer | %zu bytes in pages of %zu bytes, budget is %zu bytes", fileSize, PAGE_SIZE, memoryBudget);
+}
+
+PagedBuffer::~PagedBuffer() {
+    stopScan = true;
+    if (scanner.joinable())
+        scanner.join();
+}
+
+bool PagedBuffer::open() {
+    file.open(filename, std::ios::binary);
+    fileSize = 0;
+    if (file.is_open()) {
+        file.seekg(0, std::ios::end);
+        fileSize = file.tellg();
+    }
+    checkpoints.assign(1, 0);
+    // A file that can't be opened has nothing to scan, and is left empty
+    // if it was reloaded
+    scanDone = !file.is_open();
+    totalLines = 1;
+    stopScan = false;
+    if (!file.is_open())
+        return false;
+    scanner = std::thread(&PagedBuffer::scan, this, fileSize);
+    return true;
+}
+
+void PagedBuffer::scan(size_t size) {
+    std::ifstream in(filename, std::ios::binary);
+    std::string block(SCAN_BLOCK, '\0');
+    std::vector<size_t> found;
+    uint lineFeeds = 0;
+    for (size_t offset = 0; offset < size && !stopScan; offset += block.size()) {
+        size_t n = std::min(SCAN_BLOCK, size - offset);
+        block.resize(n);
+        if (!in.read(&block[0], n))
+            break;
+        found.clear();
+        const char* p = block.data();
+        const char* end = p + n;
+        while ((p = (const char*) memchr(p, '\n', end - p))) {
+            p++;
+            if (++lineFeeds % CHECKPOINT_LINES == 0)
+                found.push_back(offset + (p - block.data()));
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        checkpoints.insert(checkpoints.end(), found.begin(), found.end());
+        scanned.notify_all();
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    // If the scan stopped early, lines after it are treated as missing
+    scanDone = true;
+    totalLines = lineFeeds + 1;
+    scanned.notify_all();
+}
+
+void PagedBuffer::setMemoryBudget(size_t bytes) {
+    memoryBudget = bytes;
+}
+
+const std::string& PagedBuffer::page(size_t index) {
+    auto it = pageMap.find(index);
+    if (it != pageMap.end()) {
+        pages.splice(pages.begin(), pages, it->second);
+        return pages.front().text;
+    }
+    // Drop the least recently used pages to make room
+    while (!pages.empty() && (pages.size() + 1) * PAGE_SIZE > memoryBudget) {
+        pageMap.erase(pages.back().index);
+        pages.pop_back();
+    }
+    size_t start = index * PAGE_SIZE;
+    std::string text(std::min(PAGE_SIZE, fileSize - start), '\0');
+    file.clear();
+    file.seekg(start);
+    file.read(&text[0], text.length());
+    pages.push_front({index, std::move(text)});
+    pageMap[index] = pages.begin();
+    return pages.front().text;
+}
+
+size_t PagedBuffer::findLineFeed(size_t from) {
+    while (from < fileSize) {
+        const std::string& text = page(from / PAGE_SIZE);
+        size_t off = from % PAGE_SIZE;
+        const char* lf = (const char*) memchr(text.data() + off, '\n', text.length() - off);
+        if (lf)
+            return from + (lf - (text.data() + off));
+        from += text.length() - off;
+    }
+    return std::string::npos;
+}
+
+std::string_view PagedBuffer::textRange(size_t begin, size_t end) {
+    if (begin == end)
+        return {};
+    if ((end - 1) / PAGE_SIZE == begin / PAGE_SIZE)
+        return std::string_view(page(begin / PAGE_SIZE)).substr(begin % PAGE_SIZE, end - begin);
+    lineScratch.clear();
+    while (begin < end) {
+        const std::string& text = page(begin / PAGE_SIZE);
+        size_t off = begin % PAGE_SIZE;
+        size_t n = std::min(text.length() - off, end - begin);
+        lineScratch.append(text, off, n);
+        begin += n;
+    }
+    return lineScratch;
+}
+
+bool PagedBuffer::findLineStart(uint lineNum, size_t* offset) {
+    size_t checkpoint = lineNum / CHECKPOINT_LINES;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        scanned.wait(lock, [&] { return checkpoint < checkpoints.size() || scanDone; });
+        if (checkpoint >= checkpoints.size() || (scanDone && lineNum >= totalLines))
+            return false;
+        *offset = checkpoints[checkpoint];
+    }
+    // Read forward to the line from the checkpoint before it
+    for (uint line = checkpoint * CHECKPOINT_LINES; line < lineNum; line++) {
+        size_t lf = findLineFeed(*offset);
+        if (lf == std::string::npos)
+            return false;
+        *offset = lf + 1;
+    }
+    return true;
+}
+
+std::optional<std::string> PagedBuffer::getLine(uint lineNum) {
+    std::optional<std::string> line;
+    visitLines(lineNum, 1, [&](uint, std::string_view text) { line = std::string(text); });
+    return line;
+}
+
+uint PagedBuffer::visitLines(uint firstLine, uint count, const LineVisitor& visitor) {
+    size_t begin;
+    if (count == 0 || !findLineStart(firstLine, &begin))
+        return 0;
+    uint visited = 0;
+    for (uint line = firstLine; ; line++) {
+        // Include the line feed if there is one
+        size_t lf = findLineFeed(begin);
+        size_t end = lf == std::string::npos ? fileSize : lf + 1;
+        visitor(line, textRange(begin, end));
+        // Stop after the last line, which has no line feed
+        if (++visited == count || lf == std::string::npos)
+            break;
+        begin = end;
+    }
+    return visited;
+}
+
+uint PagedBuffer::visitLineSlices(uint firstLine, uint count, size_t fromCol, size_t width, const SliceVisitor& visitor) {
+    size_t begin;
+    if (count == 0 || !findLineStart(firstLine, &begin))
+        return 0;
+    uint visited = 0;
+    for (uint line = firstLine; ; line++) {
+        size_t lf = findLineFeed(begin);
+        size_t end = lf == std::string::npos ? fileSize : lf;
+        size_t from = begin + std::min(fromCol, end - begin);
+        size_t to = from + std::min(width, end - from);
+        visitor(line, {textRange(from, to), end - begin, lf != std::string::npos});
+        if (++visited == count || lf == std::string::npos)
+            break;
+        begin = end + 1;
+    }
+    return visited;
+}
+
+uint PagedBuffer::lineCount() {
+    std::unique_lock<std::mutex> lock(mutex);
+    scanned.wait(lock, [&] { return scanDone; });
+    return totalLines;
+}
+
+uint PagedBuffer::knownLineCount() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return scanDone ? totalLines : 0;
+}
+
+uint PagedBuffer::applyAppend(std::string_view text, bool) {
+    // Waits for the scan, which would otherwise be adding to the index too
+    uint lineFeeds = lineCount() - 1;
+    uint line = lineFeeds;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < text.length(); i++) {
+        if (text[i] == '\n' && ++lineFeeds % CHECKPOINT_LINES == 0)
+            checkpoints.push_back(fileSize + i + 1);
+    }
+    totalLines = lineFeeds + 1;
+    // The last page was read before the text was added to it
+    auto it = pageMap.find(fileSize / PAGE_SIZE);
+    if (it != pageMap.end()) {
+        pages.erase(it->second);
+        pageMap.erase(it);
+    }
+    fileSize += text.length();
+    // Snapshots map the file as it was
+    mapping.reset();
+    return line;
+}
+
+void PagedBuffer::applyReload() {
+    stopScan = true;
+    if (scanner.joinable())
+        scanner.join();
+    pages.clear();
+    pageMap.clear();
+    mapping.reset();
+    file.close();
+    file.clear();
+    open();
+}
+
+std::unique_ptr<Snapshot> PagedBuffer::snapshot() {
+    if (!mapping)
+        mapping = std::make_shared<MappedFile>(filename, mapSnapshots);
+    auto snapshot = std::make_unique<Snapshot>();
+    snapshot->pieces.emplace_back(mapping->data(), mapping->size());
+    snapshot->owned.push_back(mapping);
+    snapshot->mapsFile = mapping->isMapped();
+    return snapshot;
+}
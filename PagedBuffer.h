@@ -0,0 +1,102 @@
+/*
+ * PagedBuffer is a read-only view of a file that can be larger than memory.
+ * The file is read in fixed-size pages on demand, and the least recently
+ * used pages are dropped to stay under a memory budget. A background scan
+ * records where every 1024th line starts, so a line is found by reading
+ * forward from the checkpoint before it, and the view can jump anywhere in
+ * the file without loading what comes before. Lines past the scan so far
+ * wait for it to reach them.
+ * The file is shown as it is, without normalizing line endings.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "Buffer.h"
+#include "MappedFile.h"
+
+class PagedBuffer : public Buffer {
+    public:
+        // Snapshots read the file into memory instead of mapping it if not
+        // `mapSnapshots`
+        PagedBuffer(char* filename, bool mapSnapshots = true);
+        ~PagedBuffer();
+        bool isReadOnly() const { return true; }
+        std::optional<std::string> getLine(uint lineNum);
+        uint visitLines(uint firstLine, uint count, const LineVisitor& visitor);
+        uint visitLineSlices(uint firstLine, uint count, size_t fromCol, size_t width, const SliceVisitor& visitor);
+        // Waits for the scan to reach the end of the file
+        uint lineCount();
+        uint knownLineCount();
+        // Maps the file, so that the OS can drop its pages again whenever it
+        // needs the memory. They don't count towards the budget.
+        std::unique_ptr<Snapshot> snapshot();
+        // Sets how much memory pages can use (at least one page is kept)
+        void setMemoryBudget(size_t bytes);
+    protected:
+        // The text can't be edited, and Buffer doesn't call these
+        void applyDelChar(int, int) {}
+        void applyInsertChar(char, int, int) {}
+        void applyInsertText(int, int, std::string_view) {}
+        void applyDeleteRange(int, int, size_t) {}
+        // The appended text is already in the file, so only the index and
+        // the last page are updated, and the file is read from there. The
+        // file's last line is shown as it is, so text continuing it needs
+        // nothing more.
+        uint applyAppend(std::string_view text, bool continuesLine);
+        // Opens the file again and starts a new scan
+        void applyReload();
+    private:
+        struct Page {
+            size_t index;
+            std::string text;
+        };
+
+        std::ifstream file;
+        size_t fileSize = 0;
+        size_t memoryBudget = 64 << 20;
+        // Loaded pages, most recently used first
+        std::list<Page> pages;
+        std::unordered_map<size_t, std::list<Page>::iterator> pageMap;
+        // Holds text split across pages while it is visited. Reused so that
+        // visiting lines doesn't allocate.
+        std::string lineScratch;
+        // Created for the first snapshot
+        std::shared_ptr<MappedFile> mapping;
+        bool mapSnapshots;
+
+        // Scan of the file for line starts, on a thread with its own stream
+        std::thread scanner;
+        std::atomic<bool> stopScan{false};
+        // Guards the members below, which the scan adds to
+        std::mutex mutex;
+        std::condition_variable scanned;
+        // Offset where line i * CHECKPOINT_LINES starts
+        std::vector<size_t> checkpoints;
+        bool scanDone = false;
+        uint totalLines = 0;
+
+        // Opens the file and starts scanning it. Returns false if it can't be opened.
+        bool open();
+        // Scans the first `size` bytes of the file
+        void scan(size_t size);
+        // Gets a page, reading it from the file if it isn't loaded. Loading a
+        // page can drop others, so text from a page is only valid until the
+        // next one is loaded.
+        const std::string& page(size_t index);
+        // Offset of the first line feed at or after `from`, or npos if there is none
+        size_t findLineFeed(size_t from);
+        // Text between offsets `begin` and `end`, copied into lineScratch if
+        // it spans pages
+        std::string_view textRange(size_t begin, size_t end);
+        // Finds the offset where a line starts, waiting for the scan to reach
+        // its checkpoint. Returns false if there is no such line.
+        bool findLineStart(uint lineNum, size_t* offset);
+};
@@ -0,0 +1,387 @@
+#include "PieceTableBuffer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include "Trace.h"
+
+// How much of the start of the file is inspected to detect CRLF line endings
+const size_t CRLF_SNIFF_BYTES = 64 * 1024;
+
+PieceTableBuffer::PieceTableBuffer(char* filename, bool mapFile) : mapFile(mapFile) {
+    this->filename = filename;
+    load();
+}
+
+void PieceTableBuffer::load() {
+    // Map file for reading. If it doesn't exist, is a new (empty) file.
+    original = std::make_shared<MappedFile>(filename, mapFile);
+    size_t length = original->size();
+    trace("PieceTableBuffer | %s %zu bytes", mapFile ? "Mapped" : "Read", length);
+    if (length == 0)
+        return;
+    const char* data = original->data();
+
+    // Remove carriage returns. tekst uses LF, not CRLF, for simplicity.
+    // The mapping is read-only, so this is done by splitting the original into
+    // pieces around each CR. That requires scanning the whole file, so only do
+    // it if the first line shows the file uses CRLF line endings.
+    const char* lf = (const char*) memchr(data, '\n', std::min(length, CRLF_SNIFF_BYTES));
+    if (lf && lf > data && lf[-1] == '\r') {
+        trace("PieceTableBuffer | CRLF line endings, splitting pieces");
+        size_t start = 0;
+        while ((lf = (const char*) memchr(lf, '\n', data + length - lf))) {
+            size_t pos = lf - data;
+            if (pos > start && data[pos - 1] == '\r') {
+                if (pos - 1 > start)
+                    pieces.push_back({Source::Original, start, pos - 1 - start});
+                start = pos;
+            }
+            lf++;
+        }
+        pieces.push_back({Source::Original, start, length - start});
+    } else {
+        // The whole file is a single piece, nothing is read until it's accessed
+        pieces.push_back({Source::Original, 0, length});
+    }
+
+    // Every line read from a file is terminated, even if the last one isn't in the file
+    if (data[length - 1] != '\n') {
+        pieces.push_back({Source::Add, addBuffer.length(), 1});
+        appendToAddBuffer("\n");
+    }
+}
+
+// The file may have been cut short, and reading the old mapping past its new
+// end would fault, so the pieces are dropped without reading them
+void PieceTableBuffer::applyReload() {
+    pieces.clear();
+    addBuffer.clear();
+    addLineFeeds.clear();
+    originalLineFeeds.clear();
+    originalIndexedTo = 0;
+    load();
+}
+
+const char* PieceTableBuffer::pieceData(const Piece& p) const {
+    if (p.source == Source::Original)
+        return original->data() + p.start;
+    return addBuffer.data() + p.start;
+}
+
+void PieceTableBuffer::appendToAddBuffer(std::string_view text) {
+    for (size_t lf = text.find('\n'); lf != std::string::npos; lf = text.find('\n', lf + 1))
+        addLineFeeds.push_back(addBuffer.length() + lf);
+    addBuffer.append(text);
+}
+
+// Extends originalLineFeeds until it contains at least `count` entries
+// or covers the original file up to `offset`.
+void PieceTableBuffer::indexOriginal(size_t offset, size_t count) {
+    const char* data = original->data();
+    size_t length = original->size();
+    offset = std::min(offset, length);
+    while (originalIndexedTo < offset && originalLineFeeds.size() < count) {
+        const char* lf = (const char*) memchr(data + originalIndexedTo, '\n', length - originalIndexedTo);
+        if (!lf) {
+            originalIndexedTo = length;
+            break;
+        }
+        originalLineFeeds.push_back(lf - data);
+        originalIndexedTo = lf - data + 1;
+    }
+}
+
+size_t PieceTableBuffer::nthLineFeed(const Piece& p, size_t n, size_t* count) {
+    size_t end = p.start + p.length;
+    std::vector<size_t>* feeds = &addLineFeeds;
+    if (p.source == Source::Original) {
+        // Pieces over the original file are always in file order, so lines are
+        // only indexed as far as the furthest piece that has been looked at.
+        // Everything before the piece has to be indexed to find its first line feed.
+        indexOriginal(p.start, SIZE_MAX);
+        size_t before = std::lower_bound(originalLineFeeds.begin(), originalLineFeeds.end(), p.start)
+            - originalLineFeeds.begin();
+        // n is SIZE_MAX when counting all of the piece's line feeds, so the
+        // sum saturates instead of wrapping around
+        indexOriginal(end, before + std::min(n, SIZE_MAX - before));
+        feeds = &originalLineFeeds;
+    }
+    auto first = std::lower_bound(feeds->begin(), feeds->end(), p.start);
+    auto last = std::lower_bound(first, feeds->end(), end);
+    *count = last - first;
+    if (n <= *count)
+        return first[n - 1] - p.start;
+    return std::string::npos;
+}
+
+// Locates the first character of a line as a (piece index, offset in piece)
+// position, by counting line feeds piece by piece.
+bool PieceTableBuffer::findLineStart(uint lineNum, size_t* pieceIdx, size_t* offset) {
+    *pieceIdx = 0;
+    *offset = 0;
+    size_t remaining = lineNum;
+    if (remaining == 0)
+        return true;
+    for (size_t i = 0; i < pieces.size(); ++i) {
+        size_t count;
+        size_t lf = nthLineFeed(pieces[i], remaining, &count);
+        if (lf != std::string::npos) {
+            // Line starts right after the line feed, which may be in the next piece
+            if (lf + 1 < pieces[i].length) {
+                *pieceIdx = i;
+                *offset = lf + 1;
+            } else {
+                *pieceIdx = i + 1;
+            }
+            return true;
+        }
+        remaining -= count;
+    }
+    return false;
+}
+
+bool PieceTableBuffer::findPosition(int line, int col, bool needChar, size_t* pieceIdx, size_t* offset) {
+    if (line < 0 || col < 0)
+        return false;
+    size_t i, off;
+    if (!findLineStart(line, &i, &off))
+        return false;
+    size_t remaining = col;
+    while (remaining > 0) {
+        if (i >= pieces.size())
+            return false;
+        size_t step = std::min(pieces[i].length - off, remaining);
+        // Column can't be past the end of the line
+        if (memchr(pieceData(pieces[i]) + off, '\n', step))
+            return false;
+        remaining -= step;
+        off += step;
+        if (off == pieces[i].length) {
+            i++;
+            off = 0;
+        }
+    }
+    if (needChar && i >= pieces.size())
+        return false;
+    *pieceIdx = i;
+    *offset = off;
+    return true;
+}
+
+std::string_view PieceTableBuffer::readLine(size_t* pieceIdx, size_t* offset) {
+    size_t i = *pieceIdx;
+    size_t off = *offset;
+    // Collect the line's text, which may span several pieces
+    std::string_view line;
+    bool copied = false;
+    for (; i < pieces.size(); ++i, off = 0) {
+        const char* p = pieceData(pieces[i]) + off;
+        size_t avail = pieces[i].length - off;
+        const char* lf = (const char*) memchr(p, '\n', avail);
+        size_t n = lf ? lf - p + 1 : avail;
+        if (line.empty() && !copied) {
+            line = std::string_view(p, n);
+        } else {
+            if (!copied) {
+                lineScratch.assign(line);
+                copied = true;
+            }
+            lineScratch.append(p, n);
+        }
+        if (lf) {
+            off += n;
+            if (off == pieces[i].length) {
+                i++;
+                off = 0;
+            }
+            break;
+        }
+    }
+    *pieceIdx = i;
+    *offset = off;
+    return copied ? std::string_view(lineScratch) : line;
+}
+
+void PieceTableBuffer::readLineSlice(size_t* pieceIdx, size_t* offset, size_t fromCol, size_t width, LineSlice* slice) {
+    size_t i = *pieceIdx;
+    size_t off = *offset;
+    size_t sliceEnd = fromCol + width;
+    size_t length = 0; // Chars of the line before piece i
+    std::string_view text;
+    bool copied = false;
+    bool hasNewline = false;
+    for (; i < pieces.size(); ++i, off = 0) {
+        const char* p = pieceData(pieces[i]) + off;
+        size_t avail = pieces[i].length - off;
+        const char* lf = (const char*) memchr(p, '\n', avail);
+        size_t n = lf ? lf - p : avail;
+        // Part of the slice within this piece
+        size_t from = std::max(length, fromCol);
+        size_t to = std::min(length + n, sliceEnd);
+        if (from < to) {
+            std::string_view part(p + (from - length), to - from);
+            if (text.empty() && !copied) {
+                text = part;
+            } else {
+                if (!copied) {
+                    lineScratch.assign(text);
+                    copied = true;
+                }
+                lineScratch.append(part);
+            }
+        }
+        length += n;
+        if (lf) {
+            hasNewline = true;
+            off += n + 1;
+            if (off == pieces[i].length) {
+                i++;
+                off = 0;
+            }
+            break;
+        }
+    }
+    *pieceIdx = i;
+    *offset = off;
+    *slice = {copied ? std::string_view(lineScratch) : text, length, hasNewline};
+}
+
+std::optional<std::string> PieceTableBuffer::getLine(uint lineNum) {
+    size_t i, off;
+    if (!findLineStart(lineNum, &i, &off))
+        return {};
+    return std::string(readLine(&i, &off));
+}
+
+uint PieceTableBuffer::visitLines(uint firstLine, uint count, const LineVisitor& visitor) {
+    size_t i, off;
+    if (count == 0 || !findLineStart(firstLine, &i, &off))
+        return 0;
+    // Lines are read one after another from where the previous one ended
+    uint visited = 0;
+    for (uint line = firstLine; visited < count; line++) {
+        std::string_view text = readLine(&i, &off);
+        visitor(line, text);
+        visited++;
+        // Stop after the last line, which has no line feed
+        if (text.empty() || text.back() != '\n')
+            break;
+    }
+    return visited;
+}
+
+uint PieceTableBuffer::visitLineSlices(uint firstLine, uint count, size_t fromCol, size_t width, const SliceVisitor& visitor) {
+    size_t i, off;
+    if (count == 0 || !findLineStart(firstLine, &i, &off))
+        return 0;
+    uint visited = 0;
+    for (uint line = firstLine; visited < count; line++) {
+        LineSlice slice;
+        readLineSlice(&i, &off, fromCol, width, &slice);
+        visitor(line, slice);
+        visited++;
+        // Stop after the last line, which has no line feed
+        if (!slice.hasNewline)
+            break;
+    }
+    return visited;
+}
+
+// Counts the line feeds in every piece, which indexes the whole original file
+uint PieceTableBuffer::lineCount() {
+    size_t lineFeeds = 0;
+    for (const Piece& p : pieces) {
+        size_t count;
+        nthLineFeed(p, SIZE_MAX, &count);
+        lineFeeds += count;
+    }
+    return lineFeeds + 1;
+}
+
+uint PieceTableBuffer::knownLineCount() {
+    return originalIndexedTo >= original->size() ? lineCount() : 0;
+}
+
+// Only the piece list and add buffer are copied. The snapshot shares the
+// original mapping, which is read-only and stays mapped even after saving
+// replaces the file.
+std::unique_ptr<Snapshot> PieceTableBuffer::snapshot() {
+    auto add = std::make_shared<const std::string>(addBuffer);
+    auto snapshot = std::make_unique<Snapshot>();
+    snapshot->pieces.reserve(pieces.size());
+    for (const Piece& p : pieces) {
+        const char* data = p.source == Source::Original ? original->data() : add->data();
+        snapshot->pieces.emplace_back(data + p.start, p.length);
+    }
+    snapshot->owned.push_back(original);
+    snapshot->owned.push_back(add);
+    snapshot->mapsFile = original->isMapped();
+    return snapshot;
+}
+
+void PieceTableBuffer::applyDelChar(int line, int col) {
+    applyDeleteRange(line, col, 1);
+}
+
+void PieceTableBuffer::applyDeleteRange(int line, int col, size_t count) {
+    size_t i, off;
+    // No effect if out of range
+    if (count == 0 || !findPosition(line, col, true, &i, &off))
+        return;
+    if (off > 0) {
+        Piece& p = pieces[i];
+        if (off + count < p.length) {
+            // Split piece around the deleted range
+            Piece tail = {p.source, p.start + off + count, p.length - off - count};
+            p.length = off;
+            pieces.insert(pieces.begin() + i + 1, tail);
+            return;
+        }
+        // Range continues past the end of the piece, so it just gets cut short
+        count -= p.length - off;
+        p.length = off;
+        i++;
+    }
+    // Remove pieces covered by the rest of the range, and cut the start
+    // off the piece it ends in
+    size_t first = i;
+    while (i < pieces.size() && count >= pieces[i].length) {
+        count -= pieces[i].length;
+        i++;
+    }
+    if (i < pieces.size() && count > 0) {
+        pieces[i].start += count;
+        pieces[i].length -= count;
+    }
+    pieces.erase(pieces.begin() + first, pieces.begin() + i);
+}
+
+void PieceTableBuffer::applyInsertChar(char c, int line, int col) {
+    applyInsertText(line, col, std::string_view(&c, 1));
+}
+
+void PieceTableBuffer::applyInsertText(int line, int col, std::string_view text) {
+    size_t i, off;
+    // No effect if out of range
+    if (text.empty() || !findPosition(line, col, false, &i, &off))
+        return;
+    size_t addStart = addBuffer.length();
+    appendToAddBuffer(text);
+    // If continuing the previous insertion (e.g. typing), extend its piece
+    if (off == 0 && i > 0 && pieces[i - 1].source == Source::Add
+            && pieces[i - 1].start + pieces[i - 1].length == addStart) {
+        pieces[i - 1].length += text.length();
+        return;
+    }
+    Piece inserted = {Source::Add, addStart, text.length()};
+    if (off == 0) {
+        pieces.insert(pieces.begin() + i, inserted);
+        return;
+    }
+    // Split piece at insertion point
+    Piece& p = pieces[i];
+    Piece tail = {p.source, p.start + off, p.length - off};
+    p.length = off;
+    pieces.insert(pieces.begin() + i + 1, {inserted, tail});
+}
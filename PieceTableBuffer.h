@@ -0,0 +1,85 @@
+/*
+ * PieceTableBuffer keeps the original file memory-mapped and read-only, and
+ * records edits as a sequence of pieces (spans) over either the original
+ * mapping or an append-only "add" buffer holding all inserted text.
+ * Opening a file does not copy it, and memory grows with the size of the
+ * edits rather than the size of the file. A file that may be cut short while
+ * open is copied instead (see MappedFile).
+ */
+
+#pragma once
+
+#include <vector>
+#include "Buffer.h"
+#include "MappedFile.h"
+
+class PieceTableBuffer : public Buffer {
+    public:
+        // Reads the file into memory instead of mapping it if not `mapFile`
+        PieceTableBuffer(char* filename, bool mapFile = true);
+        std::optional<std::string> getLine(uint lineNum);
+        uint visitLines(uint firstLine, uint count, const LineVisitor& visitor);
+        uint visitLineSlices(uint firstLine, uint count, size_t fromCol, size_t width, const SliceVisitor& visitor);
+        uint lineCount();
+        // Known once the original file has been indexed
+        uint knownLineCount();
+        std::unique_ptr<Snapshot> snapshot();
+    protected:
+        void applyDelChar(int line, int col);
+        void applyInsertChar(char c, int line, int col);
+        void applyInsertText(int line, int col, std::string_view text);
+        void applyDeleteRange(int line, int col, size_t count);
+        void applyReload();
+    private:
+        enum class Source { Original, Add };
+        // A span of text in the document, taken from one of the two sources
+        struct Piece {
+            Source source;
+            size_t start;
+            size_t length;
+        };
+
+        // Shared with snapshots, which may outlive the buffer
+        std::shared_ptr<MappedFile> original;
+        bool mapFile;
+        // Append-only memory for all inserted text. Never modified in place
+        // so that pieces referring to it stay valid.
+        std::string addBuffer;
+        // Offsets of all '\n' chars in addBuffer (kept in sync on append)
+        std::vector<size_t> addLineFeeds;
+        // Offsets of '\n' chars in the original file, built lazily as far
+        // into the file as lines have been requested.
+        std::vector<size_t> originalLineFeeds;
+        // Number of bytes of the original file scanned into originalLineFeeds
+        size_t originalIndexedTo = 0;
+        // The document is the concatenation of all pieces, in order
+        std::vector<Piece> pieces;
+        // Holds lines spanning several pieces while they are read. Reused so
+        // that visiting lines doesn't allocate.
+        std::string lineScratch;
+
+        // Maps the file and makes its pieces
+        void load();
+        const char* pieceData(const Piece& p) const;
+        // Extends originalLineFeeds until it contains at least `count` entries
+        // or covers the original file up to `offset`.
+        void indexOriginal(size_t offset, size_t count);
+        // Finds the offset within piece `p` of its n-th (1-based) line feed.
+        // Returns npos if there are fewer, and sets `count` to the number found.
+        size_t nthLineFeed(const Piece& p, size_t n, size_t* count);
+        // Locates the first character of a line as a (piece index, offset in piece)
+        // position. Returns false if there is no such line.
+        bool findLineStart(uint lineNum, size_t* pieceIdx, size_t* offset);
+        // Locates the character at (line, col). Returns false if out of range,
+        // or if `needChar` and the position is the end of the document.
+        bool findPosition(int line, int col, bool needChar, size_t* pieceIdx, size_t* offset);
+        void appendToAddBuffer(std::string_view text);
+        // Reads the line starting at a (piece index, offset in piece) position
+        // and advances the position to the start of the next line. The line
+        // is copied into lineScratch only if it spans several pieces.
+        std::string_view readLine(size_t* pieceIdx, size_t* offset);
+        // Like readLine, but only reads up to `width` chars of the line from
+        // column `fromCol`, which are only copied if they span several pieces.
+        // The rest of the line is scanned for its line feed, but not copied.
+        void readLineSlice(size_t* pieceIdx, size_t* offset, size_t fromCol, size_t width, LineSlice* slice);
+};
@@ -0,0 +1,219 @@
+#include "RemoteBuffer.h"
+
+#include "Trace.h"
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+std::unique_ptr<RemoteBuffer> RemoteBuffer::connect(BufferType type, const std::string& filename) {
+#ifdef _WIN32
+    return nullptr;
+#else
+    std::string socketPath = defaultSocketPath();
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.length() >= sizeof(address.sun_path))
+        return nullptr;
+    memcpy(address.sun_path, socketPath.c_str(), socketPath.length());
+    // Another user could listen at a socket anyone can create, and be sent
+    // the user's edits and serve text that is then saved over the file
+    if (!isPrivateSocketDir(socketPath)) {
+        trace("RemoteBuffer | Not connecting to %s, its directory isn't private", socketPath.c_str());
+        return nullptr;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return nullptr;
+    if (::connect(fd, (const sockaddr*) &address, sizeof(address)) != 0) {
+        ::close(fd);
+        return nullptr;
+    }
+    if (!peerIsUser(fd)) {
+        trace("RemoteBuffer | Not using server at %s, it runs as another user", socketPath.c_str());
+        ::close(fd);
+        return nullptr;
+    }
+    std::unique_ptr<RemoteBuffer> b(new RemoteBuffer(fd, filename));
+    std::string payload;
+    appendNumber<uint8_t>(payload, type);
+    payload.append(absolutePath(filename));
+    RemoteReply reply;
+    if (!b->call(RemoteOp::Open, payload, &reply, false)) {
+        if (b->lost)
+            throw std::string("Lost connection to server at ") + socketPath;
+        throw reply.payload;
+    }
+    b->readOnly = reply.payload.size() > 0 && reply.payload[0];
+    b->recovered = reply.payload.size() > 1 && reply.payload[1];
+    // Edits made by other editors before this one opened the file are
+    // part of the text it starts from
+    b->version = b->latestVersion;
+    b->lines = b->latestLines;
+    trace("RemoteBuffer | Opened %s from server at %s, version %llu", filename.c_str(), socketPath.c_str(),
+        (unsigned long long) b->version);
+    return b;
+#endif
+}
+
+RemoteBuffer::RemoteBuffer(int fd, const std::string& filename) : fd(fd) {
+    this->filename = filename;
+}
+
+RemoteBuffer::~RemoteBuffer() {
+#ifndef _WIN32
+    if (!lost)
+        ::close(fd);
+#endif
+}
+
+bool RemoteBuffer::call(RemoteOp op, std::string_view payload, RemoteReply* reply, bool edit) {
+    if (lost)
+        return false;
+    if (!sendRequest(fd, op, payload) || !receiveReply(fd, reply)) {
+        trace("RemoteBuffer | Lost connection to server");
+#ifndef _WIN32
+        ::close(fd);
+#endif
+        lost = true;
+        return false;
+    }
+    // The text is only known to be as this editor left it if the version
+    // didn't change, or only moved on by this edit
+    bool caughtUp = version == latestVersion;
+    latestVersion = reply->version;
+    latestLines = reply->lines;
+    if (caughtUp && latestVersion == version + edit) {
+        version = latestVersion;
+        lines = latestLines;
+    }
+    return reply->status == RemoteStatus::Ok;
+}
+
+void RemoteBuffer::edit(RemoteOp op, int line, int col, std::string_view payload) {
+    std::string request;
+    appendNumber<uint32_t>(request, line);
+    appendNumber<uint32_t>(request, col);
+    request.append(payload);
+    RemoteReply reply;
+    call(op, request, &reply, true);
+}
+
+std::optional<std::string> RemoteBuffer::getLine(uint lineNum) {
+    std::optional<std::string> line;
+    visitLines(lineNum, 1, [&](uint, std::string_view text) { line = std::string(text); });
+    return line;
+}
+
+uint RemoteBuffer::visitLines(uint firstLine, uint count, const LineVisitor& visitor) {
+    return visitLineSlices(firstLine, count, 0, SIZE_MAX, [&](uint lineNum, const LineSlice& slice) {
+        lineScratch.assign(slice.text);
+        if (slice.hasNewline)
+            lineScratch.push_back('\n');
+        visitor(lineNum, lineScratch);
+    });
+}
+
+uint RemoteBuffer::visitLineSlices(uint firstLine, uint count, size_t fromCol, size_t width, const SliceVisitor& visitor) {
+    std::string request;
+    appendNumber<uint32_t>(request, firstLine);
+    appendNumber<uint32_t>(request, count);
+    appendNumber<uint64_t>(request, fromCol);
+    appendNumber<uint64_t>(request, width);
+    RemoteReply reply;
+    if (!call(RemoteOp::Lines, request, &reply, false))
+        return 0;
+    std::string_view in = reply.payload;
+    size_t offset = 0;
+    uint visited = readNumber<uint32_t>(in, offset);
+    for (uint i = 0; i < visited; i++) {
+        LineSlice slice;
+        slice.length = readNumber<uint64_t>(in, offset);
+        slice.hasNewline = readNumber<uint8_t>(in, offset);
+        uint64_t textLength = readNumber<uint64_t>(in, offset);
+        if (offset > in.length() || in.length() - offset < textLength)
+            return i;
+        slice.text = in.substr(offset, textLength);
+        offset += textLength;
+        visitor(firstLine + i, slice);
+    }
+    return visited;
+}
+
+uint RemoteBuffer::lineCount() {
+    if (lines == 0) {
+        RemoteReply reply;
+        call(RemoteOp::LineCount, "", &reply, false);
+        // If other editors edited the text since this one caught up with
+        // it, the count as of this one's version can't be had, and the
+        // latest is the closest
+        if (lines == 0)
+            return std::max(latestLines, 1u);
+    }
+    return lines;
+}
+
+std::unique_ptr<Snapshot> RemoteBuffer::snapshot() {
+    std::shared_ptr<const std::string> text = lastSnapshot.lock();
+    std::string request;
+    appendNumber<uint64_t>(request, text ? lastSnapshotVersion : UINT64_MAX);
+    RemoteReply reply;
+    if (call(RemoteOp::Snapshot, request, &reply, false) && !reply.payload.empty() && !reply.payload[0]) {
+        reply.payload.erase(0, 1);
+        text = std::make_shared<const std::string>(std::move(reply.payload));
+        lastSnapshot = text;
+        lastSnapshotVersion = latestVersion;
+    } else if (!text) {
+        // An empty snapshot would be saved over the file
+        throw std::string("Lost connection to server at ") + defaultSocketPath();
+    }
+    std::unique_ptr<Snapshot> snap = std::make_unique<Snapshot>();
+    snap->pieces.push_back(*text);
+    snap->owned.push_back(text);
+    return snap;
+}
+
+bool RemoteBuffer::changedElsewhere() {
+    RemoteReply reply;
+    call(RemoteOp::Poll, "", &reply, false);
+    if (lost)
+        throw std::string("Lost connection to server at ") + defaultSocketPath();
+    return version != latestVersion;
+}
+
+void RemoteBuffer::markSaved(uint64_t version) {
+    std::string request;
+    appendNumber<uint64_t>(request, version);
+    RemoteReply reply;
+    call(RemoteOp::Saved, request, &reply, false);
+}
+
+void RemoteBuffer::close() {
+    RemoteReply reply;
+    call(RemoteOp::Close, "", &reply, false);
+}
+
+void RemoteBuffer::applyDelChar(int line, int col) {
+    applyDeleteRange(line, col, 1);
+}
+
+void RemoteBuffer::applyInsertChar(char c, int line, int col) {
+    edit(RemoteOp::Insert, line, col, std::string_view(&c, 1));
+}
+
+void RemoteBuffer::applyInsertText(int line, int col, std::string_view text) {
+    edit(RemoteOp::Insert, line, col, text);
+}
+
+void RemoteBuffer::applyDeleteRange(int line, int col, size_t count) {
+    std::string request;
+    appendNumber<uint64_t>(request, count);
+    edit(RemoteOp::Delete, line, col, request);
+}
+
+void RemoteBuffer::applyReload() {
+    version = latestVersion;
+    lines = latestLines;
+}
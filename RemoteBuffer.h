@@ -0,0 +1,85 @@
+/*
+ * RemoteBuffer edits a buffer held by an editor server (see EditorServer)
+ * instead of holding the text itself. Lines are fetched from the server as
+ * they are drawn, and edits are sent to it to apply to the one buffer that
+ * every editor with the file open shares. The undo history is still kept
+ * here, so each editor undoes its own edits.
+ * The server sends the version of the text with every reply, so edits made
+ * by other editors are noticed by the version moving on by more than the
+ * edits made here (see changedElsewhere).
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include "Buffer.h"
+#include "RemoteProtocol.h"
+
+class RemoteBuffer : public Buffer {
+    public:
+        // Connects to the server listening at defaultSocketPath(), and opens
+        // the file in it as the given type of buffer unless it already has
+        // it open. Returns null if no server is listening. Throws a string
+        // if the server can't open the file.
+        static std::unique_ptr<RemoteBuffer> connect(BufferType type, const std::string& filename);
+        ~RemoteBuffer();
+        std::optional<std::string> getLine(uint lineNum);
+        uint visitLines(uint firstLine, uint count, const LineVisitor& visitor);
+        uint visitLineSlices(uint firstLine, uint count, size_t fromCol, size_t width, const SliceVisitor& visitor);
+        // Asks the server to count the lines if it didn't know how many
+        // there are yet
+        uint lineCount();
+        // The text is copied from the server, unless the last snapshot is
+        // still in use and the text hasn't changed since. Throws a string
+        // if the connection to the server was lost.
+        std::unique_ptr<Snapshot> snapshot();
+        bool isReadOnly() const { return readOnly; }
+        // Whether the server's buffer had unsaved edits of editors that
+        // crashed when this one opened it
+        bool recoveredEdits() const { return recovered; }
+        // Version of the text in the last snapshot
+        uint64_t snapshotVersion() const { return lastSnapshotVersion; }
+        // Tells the server that the text as of a snapshot's version was
+        // saved, so that it knows which edits a crash would lose
+        void markSaved(uint64_t version);
+        // Tells the server that the editor is exiting, so that unsaved
+        // edits are dropped instead of kept for the next editor
+        void close();
+        // Whether another editor changed the text since reload() was last
+        // called, which catches up with it. Throws a string if the
+        // connection to the server was lost.
+        bool changedElsewhere();
+    protected:
+        void applyDelChar(int line, int col);
+        void applyInsertChar(char c, int line, int col);
+        void applyInsertText(int line, int col, std::string_view text);
+        void applyDeleteRange(int line, int col, size_t count);
+        // Text changed by other editors is already in the server's buffer,
+        // so this only catches up with its version and number of lines
+        void applyReload();
+    private:
+        int fd;
+        bool readOnly = false;
+        bool recovered = false;
+        // Set once a request fails, after which nothing is read or edited
+        bool lost = false;
+        // Version and number of lines as of the edits made here, and as
+        // last replied by the server. They differ once other editors edit.
+        // The number of lines is 0 until the server knows it.
+        uint64_t version = 0;
+        uint lines = 1;
+        uint64_t latestVersion = 0;
+        uint latestLines = 1;
+        // Holds a line with its newline while it is visited
+        std::string lineScratch;
+        std::weak_ptr<const std::string> lastSnapshot;
+        uint64_t lastSnapshotVersion = 0;
+
+        RemoteBuffer(int fd, const std::string& filename);
+        // Sends a request and waits for the reply, keeping track of the
+        // version. Returns false if it failed or the server replied with an
+        // error, which is then in `reply`.
+        bool call(RemoteOp op, std::string_view payload, RemoteReply* reply, bool edit);
+        void edit(RemoteOp op, int line, int col, std::string_view payload);
+};
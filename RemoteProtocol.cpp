@@ -0,0 +1,148 @@
+#include "RemoteProtocol.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#ifndef _WIN32
+#include <climits>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Writes to a server or editor that went away fail instead of raising SIGPIPE
+#ifdef MSG_NOSIGNAL
+const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+const int SEND_FLAGS = 0;
+#endif
+
+std::string defaultSocketPath() {
+    if (const char* path = getenv("TEKST_SOCKET"))
+        return path;
+    if (const char* dir = getenv("XDG_RUNTIME_DIR"))
+        return std::string(dir) + "/tekst.sock";
+#ifdef _WIN32
+    return "";
+#else
+    return "/tmp/tekst-" + std::to_string(getuid()) + "/tekst.sock";
+#endif
+}
+
+bool isPrivateSocketDir(const std::string& socketPath) {
+#ifdef _WIN32
+    return false;
+#else
+    size_t slash = socketPath.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : socketPath.substr(0, slash);
+    struct stat st;
+    return lstat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode) && st.st_uid == getuid()
+        && (st.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+#endif
+}
+
+std::string absolutePath(const std::string& filename) {
+#ifdef _WIN32
+    return filename;
+#else
+    char resolved[PATH_MAX];
+    if (realpath(filename.c_str(), resolved))
+        return resolved;
+    // A file that doesn't exist yet
+    if (!filename.empty() && filename[0] == '/')
+        return filename;
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd)))
+        return filename;
+    return std::string(cwd) + "/" + filename;
+#endif
+}
+
+#ifndef _WIN32
+
+bool peerIsUser(int fd) {
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t length = sizeof(cred);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &length) == 0 && cred.uid == getuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    return getpeereid(fd, &uid, &gid) == 0 && uid == getuid();
+#endif
+}
+
+static bool sendAll(int fd, std::string_view data) {
+    while (!data.empty()) {
+        ssize_t n = send(fd, data.data(), data.length(), SEND_FLAGS);
+        if (n <= 0)
+            return false;
+        data.remove_prefix(n);
+    }
+    return true;
+}
+
+static bool receiveAll(int fd, char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = recv(fd, data, length, 0);
+        if (n <= 0)
+            return false;
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+static bool receivePayload(int fd, uint64_t length, std::string* payload) {
+    payload->resize(length);
+    return receiveAll(fd, payload->data(), length);
+}
+
+bool sendRequest(int fd, RemoteOp op, std::string_view payload) {
+    std::string header;
+    appendNumber(header, op);
+    appendNumber<uint64_t>(header, payload.length());
+    return sendAll(fd, header) && sendAll(fd, payload);
+}
+
+bool receiveRequest(int fd, RemoteOp* op, std::string* payload) {
+    char header[9];
+    if (!receiveAll(fd, header, sizeof(header)))
+        return false;
+    std::string_view in(header, sizeof(header));
+    size_t offset = 0;
+    *op = readNumber<RemoteOp>(in, offset);
+    return receivePayload(fd, readNumber<uint64_t>(in, offset), payload);
+}
+
+bool sendReply(int fd, const RemoteReply& reply) {
+    std::string header;
+    appendNumber(header, reply.status);
+    appendNumber(header, reply.version);
+    appendNumber(header, reply.lines);
+    appendNumber<uint64_t>(header, reply.payload.length());
+    return sendAll(fd, header) && sendAll(fd, reply.payload);
+}
+
+bool receiveReply(int fd, RemoteReply* reply) {
+    char header[21];
+    if (!receiveAll(fd, header, sizeof(header)))
+        return false;
+    std::string_view in(header, sizeof(header));
+    size_t offset = 0;
+    reply->status = readNumber<RemoteStatus>(in, offset);
+    reply->version = readNumber<uint64_t>(in, offset);
+    reply->lines = readNumber<uint32_t>(in, offset);
+    return receivePayload(fd, readNumber<uint64_t>(in, offset), &reply->payload);
+}
+
+#else
+
+// Unix domain sockets aren't used on Windows, where no editor connects
+bool peerIsUser(int) { return false; }
+bool sendRequest(int, RemoteOp, std::string_view) { return false; }
+bool receiveRequest(int, RemoteOp*, std::string*) { return false; }
+bool sendReply(int, const RemoteReply&) { return false; }
+bool receiveReply(int, RemoteReply*) { return false; }
+
+#endif
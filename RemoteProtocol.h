@@ -0,0 +1,96 @@
+/*
+ * Messages between an editor server (see EditorServer) and the editors
+ * connected to it (see RemoteBuffer) over a Unix domain socket.
+ * A request is an op (1 byte) and the length of its payload (8 bytes),
+ * followed by the payload. A reply is a status (1 byte), the version of the
+ * text (8 bytes), its number of lines (4 bytes, 0 if the buffer can't tell
+ * without waiting for a scan or reading through the file, see LineCount)
+ * and the length of the payload (8 bytes), followed by the payload, which
+ * is an error message if the status isn't OK. Numbers are in the machine's byte order, as both
+ * ends are on the same machine.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+enum class RemoteOp : uint8_t {
+    // Opens a file: type of buffer (1 byte) and absolute path. Replies
+    // whether the buffer is read-only (1 byte), and whether it has unsaved
+    // edits of editors that didn't close it (1 byte).
+    Open,
+    // Visits slices of lines: first line and count (4 bytes each), first
+    // column and width (8 bytes each). Replies with the number of lines
+    // visited (4 bytes), then for each line the length of the whole line
+    // (8 bytes), whether it has a newline (1 byte), and the length of the
+    // slice (8 bytes) followed by the slice.
+    Lines,
+    // Inserts text: line and column (4 bytes each), followed by the text
+    Insert,
+    // Deletes text: line and column (4 bytes each), and number of chars (8 bytes)
+    Delete,
+    // Copies all the text, unless it is still at the version given (8 bytes).
+    // Replies whether it was unchanged (1 byte), followed by the text if not.
+    Snapshot,
+    // Does nothing, for the version and number of lines in the reply
+    Poll,
+    // Counts the lines, waiting for the buffer to if it has to, for the
+    // number of lines in the reply
+    LineCount,
+    // The text as of a version (8 bytes) was saved to the file
+    Saved,
+    // The editor is exiting, and its unsaved edits are to be dropped if no
+    // other editor has the file open. Editors that disconnect without it
+    // leave their edits in the server's buffer.
+    Close,
+};
+
+enum class RemoteStatus : uint8_t { Ok, Error };
+
+struct RemoteReply {
+    RemoteStatus status;
+    // Number of edits made to the text since it was loaded
+    uint64_t version;
+    uint32_t lines;
+    std::string payload;
+};
+
+template <typename T>
+void appendNumber(std::string& out, T value) {
+    out.append((const char*) &value, sizeof(value));
+}
+
+// Reads a number at `offset` in `in`, moving the offset past it. Gives 0
+// past the end, so that a short message can't be read out of bounds.
+template <typename T>
+T readNumber(std::string_view in, size_t& offset) {
+    T value = T();
+    if (in.length() - std::min(offset, in.length()) >= sizeof(value))
+        memcpy(&value, in.data() + offset, sizeof(value));
+    offset += sizeof(value);
+    return value;
+}
+
+// Socket the server listens at: $TEKST_SOCKET if set, or tekst.sock in
+// $XDG_RUNTIME_DIR, or else in a directory in /tmp named after the user
+std::string defaultSocketPath();
+// Whether the directory holding a socket is the user's and no one else can
+// write to it, so that no one else can have put a socket there
+bool isPrivateSocketDir(const std::string& socketPath);
+// Whether the process at the other end of a connection runs as the user.
+// Editors and servers only talk to their own user's, as paths and text of
+// the user's files go between them.
+bool peerIsUser(int fd);
+// Absolute path of a file, so that editors started from different
+// directories share the server's buffer of the same file
+std::string absolutePath(const std::string& filename);
+
+// These return false if the connection was closed or failed
+bool sendRequest(int fd, RemoteOp op, std::string_view payload);
+bool receiveRequest(int fd, RemoteOp* op, std::string* payload);
+bool sendReply(int fd, const RemoteReply& reply);
+bool receiveReply(int fd, RemoteReply* reply);
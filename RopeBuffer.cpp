@@ -0,0 +1,531 @@
+#include "RopeBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+#include "Compression.h"
+#include "FileLoader.h"
+#include "Trace.h"
+#include "Utils.h"
+
+// Chunk size when splitting a file into nodes on load
+const size_t LOAD_CHUNK = 2048;
+// Chunks are split in half when edits grow them past this size
+const size_t MAX_CHUNK = 4096;
+// Chunks are compressed together in regions of up to this size (a multiple
+// of LOAD_CHUNK), which is the most Compression looks back anyway
+const size_t REGION_SIZE = 64 << 10;
+// Decompressed regions kept for reading
+const size_t HOT_REGIONS = 8;
+// Chunks within this distance of where the text was last read or edited
+// aren't compressed
+const size_t NEAR_BYTES = 256 << 10;
+// Chunks are compressed again once this many bytes were edited
+const size_t FREEZE_BYTES = 1 << 20;
+
+RopeBuffer::RopeBuffer(char* filename) {
+    this->filename = filename;
+
+    // Read whole file (if it exists) and split it into chunks, compressing
+    // every region of them. Regions are compressed independently, so split
+    // the work across threads.
+    LoadedFile file = loadFile(filename);
+    std::string_view text = file.text;
+    std::vector<std::unique_ptr<Node>> nodes((text.length() + LOAD_CHUNK - 1) / LOAD_CHUNK);
+    size_t regions = (text.length() + REGION_SIZE - 1) / REGION_SIZE;
+    size_t threads = std::min((size_t) std::max(1u, std::thread::hardware_concurrency()),
+        regions / 16 + 1);
+    std::vector<size_t> packedBytes(threads, 0);
+    parallelFor(threads, [&](size_t t) {
+        for (size_t r = regions * t / threads; r < regions * (t + 1) / threads; r++) {
+            auto region = std::make_shared<Region>();
+            std::string_view regionText = text.substr(r * REGION_SIZE, REGION_SIZE);
+            region->packed = compressBlock(regionText);
+            region->length = regionText.length();
+            packedBytes[t] += region->packed.length();
+            for (size_t offset = 0; offset < regionText.length(); offset += LOAD_CHUNK) {
+                std::string_view chunk = regionText.substr(offset, LOAD_CHUNK);
+                auto n = std::make_unique<Node>();
+                n->region = region;
+                n->regionOffset = offset;
+                n->length = chunk.length();
+                n->textLineFeeds = std::count(chunk.begin(), chunk.end(), '\n');
+                nodes[(r * REGION_SIZE + offset) / LOAD_CHUNK] = std::move(n);
+            }
+        }
+    });
+    size_t packed = 0;
+    for (size_t bytes : packedBytes)
+        packed += bytes;
+    trace("RopeBuffer | Loaded %zu chunks, compressed %zu bytes to %zu in %zu regions",
+        nodes.size(), text.length(), packed, regions);
+
+    root = build(nodes, 0, nodes.size());
+}
+
+// Builds a perfectly balanced tree from an in-order list of nodes
+std::unique_ptr<RopeBuffer::Node> RopeBuffer::build(std::vector<std::unique_ptr<Node>>& nodes, size_t begin, size_t end) {
+    if (begin >= end)
+        return nullptr;
+    size_t mid = begin + (end - begin) / 2;
+    std::unique_ptr<Node> n = std::move(nodes[mid]);
+    n->left = build(nodes, begin, mid);
+    n->right = build(nodes, mid + 1, end);
+    update(n.get());
+    return n;
+}
+
+std::string_view RopeBuffer::chunkText(const Node* n) const {
+    if (!n->region)
+        return n->text;
+    auto it = hotRegions.begin();
+    while (it != hotRegions.end() && it->first != n->region)
+        ++it;
+    if (it != hotRegions.end()) {
+        hotRegions.splice(hotRegions.begin(), hotRegions, it);
+    } else {
+        // Reuse the least recently read region's memory
+        if (hotRegions.size() < HOT_REGIONS)
+            hotRegions.emplace_front();
+        else
+            hotRegions.splice(hotRegions.begin(), hotRegions, std::prev(hotRegions.end()));
+        hotRegions.front().first = n->region;
+        decompressBlock(n->region->packed, n->region->length, hotRegions.front().second);
+    }
+    return std::string_view(hotRegions.front().second).substr(n->regionOffset, n->length);
+}
+
+void RopeBuffer::thaw(Node* n) {
+    if (!n->region)
+        return;
+    n->text = std::string(chunkText(n));
+    n->region.reset();
+    thawedBytes += n->length;
+}
+
+void RopeBuffer::freezeColdChunks() {
+    // Visits chunks in order, gathering runs of uncompressed ones that
+    // are far enough from the view and edits, and fit in a region
+    std::vector<Node*> run;
+    size_t runBytes = 0;
+    auto flush = [&]() {
+        if (!run.empty())
+            compressRun(run);
+        run.clear();
+        runBytes = 0;
+    };
+    auto isNear = [](size_t begin, size_t end, size_t offset) {
+        return end + NEAR_BYTES > offset && begin < offset + NEAR_BYTES;
+    };
+    std::vector<Node*> stack;
+    Node* n = root.get();
+    size_t offset = 0;
+    while (n || !stack.empty()) {
+        for (; n; n = n->left.get())
+            stack.push_back(n);
+        n = stack.back();
+        stack.pop_back();
+        size_t end = offset + n->length;
+        bool cold = !n->region && !isNear(offset, end, viewOffset) && !isNear(offset, end, editOffset);
+        if (!cold || runBytes + n->length > REGION_SIZE)
+            flush();
+        if (cold) {
+            run.push_back(n);
+            runBytes += n->length;
+        }
+        offset = end;
+        n = n->right.get();
+    }
+    flush();
+    thawedBytes = 0;
+}
+
+void RopeBuffer::compressRun(const std::vector<Node*>& run) {
+    std::string text;
+    for (const Node* n : run)
+        text.append(n->text);
+    auto region = std::make_shared<Region>();
+    region->packed = compressBlock(text);
+    region->length = text.length();
+    size_t offset = 0;
+    for (Node* n : run) {
+        n->region = region;
+        n->regionOffset = offset;
+        // Only the compressed text is kept
+        n->text = std::string();
+        offset += n->length;
+    }
+}
+
+// Recomputes a node's subtree totals from its children
+void RopeBuffer::update(Node* n) {
+    n->bytes = bytesOf(n->left) + n->length + bytesOf(n->right);
+    n->lineFeeds = lineFeedsOf(n->left) + n->textLineFeeds + lineFeedsOf(n->right);
+    n->height = 1 + std::max(heightOf(n->left), heightOf(n->right));
+}
+
+void RopeBuffer::rotateLeft(std::unique_ptr<Node>& n) {
+    std::unique_ptr<Node> r = std::move(n->right);
+    n->right = std::move(r->left);
+    update(n.get());
+    r->left = std::move(n);
+    update(r.get());
+    n = std::move(r);
+}
+
+void RopeBuffer::rotateRight(std::unique_ptr<Node>& n) {
+    std::unique_ptr<Node> l = std::move(n->left);
+    n->left = std::move(l->right);
+    update(n.get());
+    l->right = std::move(n);
+    update(l.get());
+    n = std::move(l);
+}
+
+// Updates a node's totals and restores the AVL height invariant after an edit below it
+void RopeBuffer::rebalance(std::unique_ptr<Node>& n) {
+    update(n.get());
+    int balance = heightOf(n->left) - heightOf(n->right);
+    if (balance > 1) {
+        if (heightOf(n->left->left) < heightOf(n->left->right))
+            rotateLeft(n->left);
+        rotateRight(n);
+    } else if (balance < -1) {
+        if (heightOf(n->right->right) < heightOf(n->right->left))
+            rotateRight(n->right);
+        rotateLeft(n);
+    }
+}
+
+// Offset of the n-th (1-based) line feed in the text, found by descending
+// towards the subtree whose line feed count covers it.
+size_t RopeBuffer::lineFeedOffset(size_t n) const {
+    if (n == 0 || n > lineFeedsOf(root))
+        return std::string::npos;
+    const Node* node = root.get();
+    size_t offset = 0;
+    while (true) {
+        size_t leftLineFeeds = lineFeedsOf(node->left);
+        if (n <= leftLineFeeds) {
+            node = node->left.get();
+            continue;
+        }
+        n -= leftLineFeeds;
+        offset += bytesOf(node->left);
+        if (n <= node->textLineFeeds) {
+            // Line feed is in this chunk, which is small enough to scan
+            std::string_view text = chunkText(node);
+            const char* p = text.data();
+            while (true) {
+                p = (const char*) memchr(p, '\n', text.data() + text.length() - p);
+                if (--n == 0)
+                    return offset + (p - text.data());
+                p++;
+            }
+        }
+        n -= node->textLineFeeds;
+        offset += node->length;
+        node = node->right.get();
+    }
+}
+
+// Gets the start offset of a line and the offset of its line feed
+// (or end of text if it has none), by descending on line feed counts.
+bool RopeBuffer::getLineBounds(uint lineNum, size_t* beginP, size_t* endP) const {
+    size_t begin = 0;
+    if (lineNum > 0) {
+        begin = lineFeedOffset(lineNum);
+        if (begin == std::string::npos)
+            return false;
+        begin++;
+    }
+    size_t end = lineFeedOffset((size_t) lineNum + 1);
+    *beginP = begin;
+    *endP = end == std::string::npos ? bytesOf(root) : end;
+    return true;
+}
+
+const RopeBuffer::Node* RopeBuffer::chunkAt(size_t offset, size_t* chunkOffset) const {
+    const Node* node = root.get();
+    while (true) {
+        size_t leftBytes = bytesOf(node->left);
+        if (offset < leftBytes) {
+            node = node->left.get();
+            continue;
+        }
+        offset -= leftBytes;
+        if (offset < node->length) {
+            *chunkOffset = offset;
+            return node;
+        }
+        offset -= node->length;
+        node = node->right.get();
+    }
+}
+
+void RopeBuffer::appendRange(size_t begin, size_t end, std::string& out) const {
+    while (begin < end) {
+        size_t off;
+        const Node* node = chunkAt(begin, &off);
+        size_t n = std::min(node->length - off, end - begin);
+        out.append(chunkText(node).substr(off, n));
+        begin += n;
+    }
+}
+
+std::string_view RopeBuffer::textRange(size_t begin, size_t end) {
+    if (begin == end)
+        return {};
+    size_t off;
+    const Node* node = chunkAt(begin, &off);
+    if (off + (end - begin) <= node->length)
+        return chunkText(node).substr(off, end - begin);
+    lineScratch.clear();
+    appendRange(begin, end, lineScratch);
+    return lineScratch;
+}
+
+std::optional<std::string> RopeBuffer::getLine(uint lineNum) {
+    size_t begin, end;
+    if (!getLineBounds(lineNum, &begin, &end))
+        return {};
+    viewOffset = begin;
+    // Include the line feed if there is one
+    end = std::min(end + 1, bytesOf(root));
+    std::string line;
+    line.reserve(end - begin);
+    appendRange(begin, end, line);
+    return line;
+}
+
+uint RopeBuffer::visitLines(uint firstLine, uint count, const LineVisitor& visitor) {
+    size_t begin, end;
+    if (count == 0 || !getLineBounds(firstLine, &begin, &end))
+        return 0;
+    viewOffset = begin;
+    size_t total = bytesOf(root);
+    uint visited = 0;
+    for (uint line = firstLine; ; line++) {
+        // Include the line feed if there is one
+        visitor(line, textRange(begin, std::min(end + 1, total)));
+        // Stop after the last line, which has no line feed
+        if (++visited == count || end == total)
+            break;
+        begin = end + 1;
+        end = lineFeedOffset((size_t) line + 2);
+        if (end == std::string::npos)
+            end = total;
+    }
+    return visited;
+}
+
+uint RopeBuffer::visitLineSlices(uint firstLine, uint count, size_t fromCol, size_t width, const SliceVisitor& visitor) {
+    size_t begin, end;
+    if (count == 0 || !getLineBounds(firstLine, &begin, &end))
+        return 0;
+    viewOffset = begin;
+    size_t total = bytesOf(root);
+    uint visited = 0;
+    for (uint line = firstLine; ; line++) {
+        size_t from = begin + std::min(fromCol, end - begin);
+        size_t to = from + std::min(width, end - from);
+        visitor(line, {textRange(from, to), end - begin, end < total});
+        if (++visited == count || end == total)
+            break;
+        begin = end + 1;
+        end = lineFeedOffset((size_t) line + 2);
+        if (end == std::string::npos)
+            end = total;
+    }
+    return visited;
+}
+
+uint RopeBuffer::lineCount() {
+    return lineFeedsOf(root) + 1;
+}
+
+// Only chunks that aren't compressed are copied. Compressed ones are handed
+// out still compressed, as one piece per run of chunks from the same region,
+// which the snapshot shares since regions are never changed.
+std::unique_ptr<Snapshot> RopeBuffer::snapshot() {
+    auto snapshot = std::make_unique<Snapshot>();
+    std::shared_ptr<std::string> text;
+    auto flushText = [&]() {
+        if (!text)
+            return;
+        snapshot->pieces.push_back(*text);
+        snapshot->packed.emplace_back();
+        snapshot->owned.push_back(std::move(text));
+        text = nullptr;
+    };
+    const Region* lastRegion = nullptr;
+    std::vector<const Node*> stack;
+    const Node* n = root.get();
+    while (n || !stack.empty()) {
+        for (; n; n = n->left.get())
+            stack.push_back(n);
+        n = stack.back();
+        stack.pop_back();
+        if (!n->region) {
+            if (!text)
+                text = std::make_shared<std::string>();
+            text->append(n->text);
+            lastRegion = nullptr;
+        } else if (n->region.get() == lastRegion
+                && n->regionOffset == snapshot->packed.back().offset + snapshot->packed.back().length) {
+            snapshot->packed.back().length += n->length;
+        } else {
+            flushText();
+            snapshot->pieces.push_back(n->region->packed);
+            snapshot->packed.push_back({n->region->length, n->regionOffset, n->length});
+            snapshot->owned.push_back(n->region);
+            lastRegion = n->region.get();
+        }
+        n = n->right.get();
+    }
+    flushText();
+    return snapshot;
+}
+
+// Inserts text at `offset` within the subtree, splitting the chunk if it grows too large.
+// The text must be no longer than LOAD_CHUNK, so that splitting once is enough.
+void RopeBuffer::insertAt(std::unique_ptr<Node>& n, size_t offset, std::string_view text) {
+    size_t leftBytes = bytesOf(n->left);
+    if (offset < leftBytes) {
+        insertAt(n->left, offset, text);
+    } else if (offset - leftBytes <= n->length) {
+        thaw(n.get());
+        n->text.insert(offset - leftBytes, text);
+        n->length = n->text.length();
+        n->textLineFeeds += std::count(text.begin(), text.end(), '\n');
+        if (n->text.length() > MAX_CHUNK) {
+            // Move second half of chunk into a new node directly after this one
+            auto tail = std::make_unique<Node>();
+            tail->text = n->text.substr(n->text.length() / 2);
+            tail->length = tail->text.length();
+            tail->textLineFeeds = std::count(tail->text.begin(), tail->text.end(), '\n');
+            n->text.resize(n->text.length() / 2);
+            n->length = n->text.length();
+            n->textLineFeeds -= tail->textLineFeeds;
+            insertLeftmost(n->right, std::move(tail));
+        }
+    } else {
+        insertAt(n->right, offset - leftBytes - n->length, text);
+    }
+    rebalance(n);
+}
+
+void RopeBuffer::insertLeftmost(std::unique_ptr<Node>& n, std::unique_ptr<Node> node) {
+    if (!n) {
+        update(node.get());
+        n = std::move(node);
+        return;
+    }
+    insertLeftmost(n->left, std::move(node));
+    rebalance(n);
+}
+
+// Erases `count` chars from `offset` within the subtree, which must all be in
+// the same chunk. Removes the chunk if it becomes empty.
+void RopeBuffer::eraseAt(std::unique_ptr<Node>& n, size_t offset, size_t count) {
+    size_t leftBytes = bytesOf(n->left);
+    if (offset < leftBytes) {
+        eraseAt(n->left, offset, count);
+    } else if (offset - leftBytes < n->length) {
+        // A whole chunk is removed without decompressing it
+        if (count == n->length) {
+            removeNode(n);
+            return;
+        }
+        thaw(n.get());
+        auto erased = n->text.begin() + (offset - leftBytes);
+        n->textLineFeeds -= std::count(erased, erased + count, '\n');
+        n->text.erase(offset - leftBytes, count);
+        n->length = n->text.length();
+    } else {
+        eraseAt(n->right, offset - leftBytes - n->length, count);
+    }
+    rebalance(n);
+}
+
+// Removes a node from the tree, replacing it with its in-order successor
+void RopeBuffer::removeNode(std::unique_ptr<Node>& n) {
+    if (!n->left) {
+        n = std::move(n->right);
+        return;
+    }
+    if (!n->right) {
+        n = std::move(n->left);
+        return;
+    }
+    std::unique_ptr<Node> successor = removeLeftmost(n->right);
+    successor->left = std::move(n->left);
+    successor->right = std::move(n->right);
+    n = std::move(successor);
+    rebalance(n);
+}
+
+std::unique_ptr<RopeBuffer::Node> RopeBuffer::removeLeftmost(std::unique_ptr<Node>& n) {
+    if (!n->left) {
+        std::unique_ptr<Node> node = std::move(n);
+        n = std::move(node->right);
+        return node;
+    }
+    std::unique_ptr<Node> node = removeLeftmost(n->left);
+    rebalance(n);
+    return node;
+}
+
+void RopeBuffer::applyDelChar(int line, int col) {
+    applyDeleteRange(line, col, 1);
+}
+
+void RopeBuffer::applyDeleteRange(int line, int col, size_t count) {
+    size_t begin, end;
+    // No effect if out of range
+    if (line < 0 || col < 0 || !getLineBounds(line, &begin, &end))
+        return;
+    if (col > end - begin || begin + col >= bytesOf(root))
+        return;
+    size_t offset = begin + col;
+    count = std::min(count, bytesOf(root) - offset);
+    // Erase a chunk's worth of the range at a time
+    while (count > 0) {
+        size_t chunkOffset;
+        const Node* node = chunkAt(offset, &chunkOffset);
+        size_t n = std::min(count, node->length - chunkOffset);
+        eraseAt(root, offset, n);
+        count -= n;
+    }
+    editOffset = offset;
+    if (thawedBytes > FREEZE_BYTES)
+        freezeColdChunks();
+}
+
+void RopeBuffer::applyInsertChar(char c, int line, int col) {
+    applyInsertText(line, col, std::string_view(&c, 1));
+}
+
+void RopeBuffer::applyInsertText(int line, int col, std::string_view text) {
+    size_t begin, end;
+    // No effect if out of range
+    if (line < 0 || col < 0 || !getLineBounds(line, &begin, &end))
+        return;
+    if (col > end - begin || text.empty())
+        return;
+    if (!root) {
+        root = std::make_unique<Node>();
+        update(root.get());
+    }
+    // Insert in pieces no larger than a loaded chunk, so each insert
+    // splits at most one chunk and keeps the tree balanced
+    size_t offset = begin + col;
+    for (size_t i = 0; i < text.length(); i += LOAD_CHUNK) {
+        std::string_view piece = text.substr(i, LOAD_CHUNK);
+        insertAt(root, offset, piece);
+        offset += piece.length();
+    }
+    editOffset = offset;
+    thawedBytes += text.length();
+    if (thawedBytes > FREEZE_BYTES)
+        freezeColdChunks();
+}
@@ -0,0 +1,104 @@
+/*
+ * RopeBuffer stores the text as a balanced binary tree (AVL) of small chunks.
+ * Every node caches the byte count and line feed count of its subtree, so
+ * lines and positions are found by walking down the tree, and every edit is
+ * O(log n) no matter where it lands in the file.
+ * Chunks away from where the text was last read or edited are kept
+ * compressed, in regions of consecutive chunks compressed together. Reading
+ * a compressed chunk decompresses its region into a small cache of recently
+ * read regions, and editing one copies it out of its region. Snapshots share
+ * the regions, which are only decompressed when the snapshot is read.
+ */
+
+#pragma once
+
+#include <list>
+#include <memory>
+#include <vector>
+#include "Buffer.h"
+
+class RopeBuffer : public Buffer {
+    public:
+        RopeBuffer(char* filename);
+        std::optional<std::string> getLine(uint lineNum);
+        uint visitLines(uint firstLine, uint count, const LineVisitor& visitor);
+        uint visitLineSlices(uint firstLine, uint count, size_t fromCol, size_t width, const SliceVisitor& visitor);
+        uint lineCount();
+        std::unique_ptr<Snapshot> snapshot();
+    protected:
+        void applyDelChar(int line, int col);
+        void applyInsertChar(char c, int line, int col);
+        void applyInsertText(int line, int col, std::string_view text);
+        void applyDeleteRange(int line, int col, size_t count);
+    private:
+        // Compressed text of a run of consecutive chunks
+        struct Region {
+            std::string packed;
+            size_t length = 0;
+        };
+        struct Node {
+            // Chunk of text held by this node, in-order between its subtrees.
+            // Empty while the chunk is compressed in `region` instead.
+            std::string text;
+            std::shared_ptr<const Region> region;
+            // Where the chunk starts in its region's text
+            size_t regionOffset = 0;
+            // Length of the chunk, whether or not it is compressed
+            size_t length = 0;
+            size_t textLineFeeds = 0;
+            std::unique_ptr<Node> left;
+            std::unique_ptr<Node> right;
+            // Totals for the subtree rooted at this node
+            size_t bytes = 0;
+            size_t lineFeeds = 0;
+            int height = 1;
+        };
+
+        std::unique_ptr<Node> root;
+        // Holds lines split across chunks while they are visited. Reused so
+        // that visiting lines doesn't allocate.
+        std::string lineScratch;
+        // Recently read regions' text, most recently read first
+        mutable std::list<std::pair<std::shared_ptr<const Region>, std::string>> hotRegions;
+        // Offsets the text was last read and edited at. Chunks near them
+        // aren't compressed.
+        size_t viewOffset = 0;
+        size_t editOffset = 0;
+        // Bytes inserted into or copied out of regions since chunks were last compressed
+        size_t thawedBytes = 0;
+
+        // Offset of the n-th (1-based) line feed in the text, or npos if there are fewer
+        size_t lineFeedOffset(size_t n) const;
+        // Gets the start offset of a line and the offset of its line feed (or
+        // end of text if it has none). Returns false if there is no such line.
+        bool getLineBounds(uint lineNum, size_t* beginP, size_t* endP) const;
+        // Finds the node holding the char at `offset`, and the char's offset in it
+        const Node* chunkAt(size_t offset, size_t* chunkOffset) const;
+        void appendRange(size_t begin, size_t end, std::string& out) const;
+        // Text between offsets `begin` and `end`, copied into lineScratch
+        // if it spans more than one chunk
+        std::string_view textRange(size_t begin, size_t end);
+        // Text of a node's chunk, decompressing its region if it isn't
+        // cached. Only valid until another region is decompressed.
+        std::string_view chunkText(const Node* n) const;
+        // Copies a chunk out of its region, so that it can be edited
+        void thaw(Node* n);
+        // Compresses runs of chunks that are far from where the text was
+        // last read and edited into new regions
+        void freezeColdChunks();
+        void compressRun(const std::vector<Node*>& run);
+        void insertAt(std::unique_ptr<Node>& n, size_t offset, std::string_view text);
+        void eraseAt(std::unique_ptr<Node>& n, size_t offset, size_t count);
+
+        static std::unique_ptr<Node> build(std::vector<std::unique_ptr<Node>>& nodes, size_t begin, size_t end);
+        static void insertLeftmost(std::unique_ptr<Node>& n, std::unique_ptr<Node> node);
+        static void removeNode(std::unique_ptr<Node>& n);
+        static std::unique_ptr<Node> removeLeftmost(std::unique_ptr<Node>& n);
+        static size_t bytesOf(const std::unique_ptr<Node>& n) { return n ? n->bytes : 0; }
+        static size_t lineFeedsOf(const std::unique_ptr<Node>& n) { return n ? n->lineFeeds : 0; }
+        static int heightOf(const std::unique_ptr<Node>& n) { return n ? n->height : 0; }
+        static void update(Node* n);
+        static void rebalance(std::unique_ptr<Node>& n);
+        static void rotateLeft(std::unique_ptr<Node>& n);
+        static void rotateRight(std::unique_ptr<Node>& n);
+};
@@ -0,0 +1,175 @@
+#include "Trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+// Number of events kept, a power of two
+const size_t RING_SIZE = 4096;
+// Length of an event's text, a multiple of the 8 byte words it is stored in
+const size_t EVENT_TEXT = 112;
+const size_t EVENT_WORDS = EVENT_TEXT / 8;
+// Latencies are bucketed by their power of two in nanoseconds, and each
+// power of two is split into SUB_BUCKETS, so percentiles are within 25%
+const int SUB_BITS = 2;
+const int SUB_BUCKETS = 1 << SUB_BITS;
+const int BUCKETS = 64 * SUB_BUCKETS;
+
+const char* const OP_NAMES[] = { "load", "getLine", "insertChar", "delChar", "save", "repaint", "key" };
+
+namespace {
+    struct Event {
+        // Number of the event plus one once it is written, so that a slot
+        // that is being written (or was never written) can be told apart.
+        // Readers check it again after copying the event, since a writer
+        // may have started writing over it meanwhile.
+        std::atomic<uint64_t> sequence{0};
+        // Stored as atomic words, so that a slot can be copied while it is
+        // being written over without a data race
+        std::atomic<uint64_t> micros{0};
+        std::atomic<uint64_t> text[EVENT_WORDS] = {};
+    };
+
+    struct Histogram {
+        std::atomic<uint64_t> buckets[BUCKETS] = {};
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> maxNanos{0};
+    };
+
+    Event ring[RING_SIZE];
+    std::atomic<uint64_t> nextEvent{0};
+    Histogram histograms[(size_t) TraceOp::Count];
+    const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+}
+
+void trace(const char* format, ...) {
+    uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+    char text[EVENT_TEXT] = {};
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, EVENT_TEXT, format, args);
+    va_end(args);
+
+    uint64_t n = nextEvent.fetch_add(1, std::memory_order_relaxed);
+    Event& event = ring[n % RING_SIZE];
+    event.sequence.store(0, std::memory_order_relaxed);
+    // Readers that see any of the words below also see the slot cleared
+    std::atomic_thread_fence(std::memory_order_release);
+    event.micros.store(micros, std::memory_order_relaxed);
+    for (size_t i = 0; i < EVENT_WORDS; i++) {
+        uint64_t word;
+        memcpy(&word, text + i * 8, 8);
+        event.text[i].store(word, std::memory_order_relaxed);
+    }
+    event.sequence.store(n + 1, std::memory_order_release);
+}
+
+static int bucketOf(uint64_t nanos) {
+    if (nanos < SUB_BUCKETS)
+        return nanos;
+    int power = 63 - __builtin_clzll(nanos);
+    int sub = (nanos >> (power - SUB_BITS)) & (SUB_BUCKETS - 1);
+    return (power - SUB_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+// Largest latency that falls in a bucket
+static uint64_t bucketLimit(int bucket) {
+    if (bucket < SUB_BUCKETS)
+        return bucket;
+    int power = bucket / SUB_BUCKETS + SUB_BITS - 1;
+    uint64_t sub = bucket % SUB_BUCKETS;
+    return ((SUB_BUCKETS + sub + 1) << (power - SUB_BITS)) - 1;
+}
+
+void recordLatency(TraceOp op, std::chrono::steady_clock::duration elapsed) {
+    uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    Histogram& h = histograms[(size_t) op];
+    h.buckets[bucketOf(nanos)].fetch_add(1, std::memory_order_relaxed);
+    h.count.fetch_add(1, std::memory_order_relaxed);
+    uint64_t max = h.maxNanos.load(std::memory_order_relaxed);
+    while (nanos > max && !h.maxNanos.compare_exchange_weak(max, nanos, std::memory_order_relaxed)) {}
+}
+
+// Latency below which a fraction of the runs of an operation took
+static uint64_t percentile(const Histogram& h, uint64_t count, double fraction) {
+    uint64_t rank = count * fraction;
+    uint64_t seen = 0;
+    uint64_t max = h.maxNanos.load(std::memory_order_relaxed);
+    for (int b = 0; b < BUCKETS; b++) {
+        seen += h.buckets[b].load(std::memory_order_relaxed);
+        if (seen > rank)
+            return std::min(bucketLimit(b), max);
+    }
+    return max;
+}
+
+// Formats nanoseconds in the largest unit that keeps them above 1
+static std::string formatNanos(uint64_t nanos) {
+    char text[32];
+    if (nanos < 1000)
+        snprintf(text, sizeof(text), "%lluns", (unsigned long long) nanos);
+    else if (nanos < 1000000)
+        snprintf(text, sizeof(text), "%.3gus", nanos / 1e3);
+    else if (nanos < 1000000000)
+        snprintf(text, sizeof(text), "%.3gms", nanos / 1e6);
+    else
+        snprintf(text, sizeof(text), "%.3gs", nanos / 1e9);
+    return text;
+}
+
+std::string traceSummary() {
+    std::string summary;
+    for (size_t op = 0; op < (size_t) TraceOp::Count; op++) {
+        const Histogram& h = histograms[op];
+        uint64_t count = h.count.load(std::memory_order_relaxed);
+        if (count == 0)
+            continue;
+        if (!summary.empty())
+            summary += "  ";
+        summary += std::string(OP_NAMES[op]) + " " + formatNanos(percentile(h, count, 0.5))
+            + "/" + formatNanos(percentile(h, count, 0.99));
+    }
+    return summary.empty() ? "No latencies recorded" : "p50/p99  " + summary;
+}
+
+void dumpTrace(std::ostream& out) {
+    uint64_t end = nextEvent.load(std::memory_order_acquire);
+    uint64_t begin = end > RING_SIZE ? end - RING_SIZE : 0;
+    if (begin > 0)
+        out << "(" << begin << " earlier events dropped)\n";
+    for (uint64_t n = begin; n < end; n++) {
+        const Event& event = ring[n % RING_SIZE];
+        // Skip events overwritten or still being written, before or while
+        // they are copied
+        if (event.sequence.load(std::memory_order_acquire) != n + 1)
+            continue;
+        uint64_t micros = event.micros.load(std::memory_order_relaxed);
+        char text[EVENT_TEXT];
+        for (size_t i = 0; i < EVENT_WORDS; i++) {
+            uint64_t word = event.text[i].load(std::memory_order_relaxed);
+            memcpy(text + i * 8, &word, 8);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (event.sequence.load(std::memory_order_relaxed) != n + 1)
+            continue;
+        text[EVENT_TEXT - 1] = '\0';
+        char time[32];
+        snprintf(time, sizeof(time), "%10.3f ", micros / 1e6);
+        out << time << text << "\n";
+    }
+    out << "\noperation        count        p50        p90        p99        max\n";
+    for (size_t op = 0; op < (size_t) TraceOp::Count; op++) {
+        const Histogram& h = histograms[op];
+        uint64_t count = h.count.load(std::memory_order_relaxed);
+        if (count == 0)
+            continue;
+        char line[128];
+        snprintf(line, sizeof(line), "%-12s %9llu %10s %10s %10s %10s\n", OP_NAMES[op], (unsigned long long) count,
+            formatNanos(percentile(h, count, 0.5)).c_str(), formatNanos(percentile(h, count, 0.9)).c_str(),
+            formatNanos(percentile(h, count, 0.99)).c_str(), formatNanos(h.maxNanos.load(std::memory_order_relaxed)).c_str());
+        out << line;
+    }
+    out.flush();
+}
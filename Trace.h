@@ -0,0 +1,44 @@
+/*
+ * Trace is tekst's instrumentation: a fixed-size ring of recent log events,
+ * and latency histograms of the operations that make keystrokes slow or
+ * fast. Both can be written to from any thread without locking, and take
+ * no memory beyond their fixed size however long the editor runs.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Operations whose latencies are recorded
+enum class TraceOp { Load, GetLine, InsertChar, DelChar, Save, Repaint, Key, Count };
+
+// Logs an event, formatted like printf. Events are cut off at about 100
+// chars, and only the most recent few thousand are kept.
+void trace(const char* format, ...)
+#ifdef __GNUC__
+    __attribute__((format(printf, 1, 2)))
+#endif
+    ;
+
+// Records how long one run of an operation took
+void recordLatency(TraceOp op, std::chrono::steady_clock::duration elapsed);
+
+// Records the time from its creation to its destruction as one run of an operation
+class TraceTimer {
+    public:
+        TraceTimer(TraceOp op) : op(op), start(std::chrono::steady_clock::now()) {}
+        ~TraceTimer() { recordLatency(op, std::chrono::steady_clock::now() - start); }
+    private:
+        TraceOp op;
+        std::chrono::steady_clock::time_point start;
+};
+
+// One line summing up the median and 99th percentile latency of each
+// operation recorded so far, e.g. for a status bar
+std::string traceSummary();
+// Writes the events in the ring, oldest first, followed by a table of
+// latency percentiles. Events written over while they are read are skipped.
+void dumpTrace(std::ostream& out);
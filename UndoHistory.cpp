@@ -0,0 +1,142 @@
+#include "UndoHistory.h"
+
+#include <algorithm>
+#include "Trace.h"
+
+// Gets the position after text inserted at (line, col)
+static void endOf(std::string_view text, int line, int col, int* endLine, int* endCol) {
+    size_t lineFeeds = std::count(text.begin(), text.end(), '\n');
+    *endLine = line + lineFeeds;
+    *endCol = lineFeeds ? text.length() - text.rfind('\n') - 1 : col + text.length();
+}
+
+void UndoHistory::addRecord(Kind kind, int line, int col, std::string_view text, bool coalesce) {
+    // A new edit discards everything that was undone
+    if (current < records.size()) {
+        arena.resize(records[current].textStart);
+        records.resize(current);
+    }
+    Record r = {arena.length(), text.length(), line, col, 0, 0, kind, coalesce, grouping && groupStarted};
+    groupStarted = grouping;
+    endOf(text, line, col, &r.endLine, &r.endCol);
+    arena.append(text);
+    records.push_back(r);
+    current = records.size();
+    trim();
+}
+
+void UndoHistory::recordInsert(int line, int col, std::string_view text, bool coalesce) {
+    // Typing continues a run if it is right where the run ends
+    if (coalesce && current == records.size() && !records.empty()) {
+        Record& r = records.back();
+        if (r.open && r.kind == Kind::Insert && r.endLine == line && r.endCol == col) {
+            arena.append(text);
+            r.textLength += text.length();
+            endOf(text, line, col, &r.endLine, &r.endCol);
+            trim();
+            return;
+        }
+    }
+    addRecord(Kind::Insert, line, col, text, coalesce);
+}
+
+void UndoHistory::recordDelete(int line, int col, std::string_view text, bool coalesce) {
+    if (coalesce && current == records.size() && !records.empty()) {
+        Record& r = records.back();
+        int endLine, endCol;
+        endOf(text, line, col, &endLine, &endCol);
+        if (r.open && r.kind == Kind::Delete && r.line == line && r.col == col) {
+            // Deleting forwards, the text came after the run's text
+            arena.append(text);
+            r.textLength += text.length();
+            trim();
+            return;
+        }
+        if (r.open && r.kind == Kind::Delete && r.line == endLine && r.col == endCol) {
+            // Backspacing, the text came before the run's text. The run is
+            // at the end of the arena, so only the run itself is shifted.
+            arena.insert(r.textStart, text);
+            r.textLength += text.length();
+            r.line = line;
+            r.col = col;
+            trim();
+            return;
+        }
+    }
+    addRecord(Kind::Delete, line, col, text, coalesce);
+}
+
+void UndoHistory::seal() {
+    if (!records.empty())
+        records.back().open = false;
+}
+
+void UndoHistory::beginGroup() {
+    seal();
+    grouping = true;
+    groupStarted = false;
+}
+
+void UndoHistory::endGroup() {
+    seal();
+    grouping = false;
+}
+
+bool UndoHistory::undo(Edit* edit) {
+    if (current == 0)
+        return false;
+    Record& r = records[--current];
+    r.open = false;
+    *edit = {r.kind, r.line, r.col, std::string_view(arena).substr(r.textStart, r.textLength), r.joined};
+    return true;
+}
+
+bool UndoHistory::redo(Edit* edit) {
+    if (current == records.size())
+        return false;
+    const Record& r = records[current++];
+    bool more = current < records.size() && records[current].joined;
+    *edit = {r.kind, r.line, r.col, std::string_view(arena).substr(r.textStart, r.textLength), more};
+    return true;
+}
+
+void UndoHistory::clear() {
+    records.clear();
+    arena.clear();
+    current = 0;
+    grouping = false;
+    groupStarted = false;
+}
+
+void UndoHistory::setMaxBytes(size_t bytes) {
+    maxBytes = bytes;
+    trim();
+}
+
+void UndoHistory::trim() {
+    size_t used = arena.length() + records.size() * sizeof(Record);
+    if (used <= maxBytes)
+        return;
+    // Drop the oldest records until well under the cap, so that compacting
+    // (which moves all remaining text) doesn't happen on every edit
+    size_t dropped = 0;
+    while (dropped < records.size() && used > maxBytes / 4 * 3) {
+        used -= records[dropped].textLength + sizeof(Record);
+        dropped++;
+    }
+    // Don't split up a group
+    while (dropped < records.size() && records[dropped].joined)
+        used -= records[dropped++].textLength + sizeof(Record);
+    size_t textDropped = dropped < records.size() ? records[dropped].textStart : arena.length();
+    records.erase(records.begin(), records.begin() + dropped);
+    arena.erase(0, textDropped);
+    for (Record& r : records)
+        r.textStart -= textDropped;
+    current -= std::min(current, dropped);
+    if (records.empty()) {
+        // Release memory held by a run that was too large to keep
+        arena.shrink_to_fit();
+        records.shrink_to_fit();
+    }
+    trace("UndoHistory | Dropped %zu oldest runs (%zu bytes)", dropped, textDropped);
+}
@@ -0,0 +1,85 @@
+/*
+ * UndoHistory records the edits made to a buffer so they can be undone and
+ * redone. Consecutive single-character edits at adjacent positions (typing,
+ * backspacing or deleting forwards) are coalesced into one run, which is
+ * undone as a whole, as is every bulk edit such as a paste.
+ * The text of all runs is kept back to back in one arena string, so a run
+ * costs a fixed-size record plus its characters. When the history grows past
+ * its memory cap, the oldest runs are dropped and the arena is compacted.
+ * Edits can also be grouped, so that e.g. a replace is undone as one.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+class UndoHistory {
+    public:
+        enum class Kind : char { Insert, Delete };
+        // An edit to undo or redo. The text is only valid until the next
+        // call that changes the history.
+        struct Edit {
+            Kind kind;
+            int line;
+            int col;
+            std::string_view text;
+            // Whether the next edit in the same direction belongs to the
+            // same group, and has to be undone or redone along with this one
+            bool more;
+        };
+
+        // Records text inserted at (line, col). If `coalesce`, the text is
+        // added to the current run when it continues it.
+        void recordInsert(int line, int col, std::string_view text, bool coalesce);
+        // Records text deleted from (line, col), coalescing like recordInsert
+        void recordDelete(int line, int col, std::string_view text, bool coalesce);
+        // Ends the current run, so the next edit starts a new one
+        void seal();
+        // Edits recorded between these are undone and redone together
+        void beginGroup();
+        void endGroup();
+        // Steps back through the history, giving the edit that has to be
+        // reverted. Returns false if there is nothing to undo.
+        bool undo(Edit* edit);
+        // Steps forward through the history, giving the edit that has to be
+        // applied again. Returns false if there is nothing to redo.
+        bool redo(Edit* edit);
+
+        // Forgets all edits, for when the text is replaced as a whole
+        void clear();
+        // Maximum memory used by the history, in bytes
+        void setMaxBytes(size_t bytes);
+        size_t memoryUsed() const { return arena.capacity() + records.capacity() * sizeof(Record); }
+    private:
+        struct Record {
+            // Text of the run in the arena
+            size_t textStart;
+            size_t textLength;
+            // Where the text starts, and (for inserts) ends
+            int line;
+            int col;
+            int endLine;
+            int endCol;
+            Kind kind;
+            // Whether later edits can still be coalesced into this run
+            bool open;
+            // Whether this is undone and redone along with the record before it
+            bool joined;
+        };
+
+        std::vector<Record> records;
+        std::string arena;
+        // Records before this are done, and the rest have been undone
+        size_t current = 0;
+        size_t maxBytes = 64 << 20;
+        bool grouping = false;
+        // Whether the current group has a record yet
+        bool groupStarted = false;
+
+        // Adds a record for new text, dropping any undone records first
+        void addRecord(Kind kind, int line, int col, std::string_view text, bool coalesce);
+        // Drops the oldest records while over the memory cap
+        void trim();
+};
@@ -0,0 +1,229 @@
+#include "Utf8.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Ranges of code points (first, last) that take no column or two columns,
+// from Unicode's combining marks and East Asian Wide and Fullwidth chars
+struct CodePointRange {
+    uint32_t first;
+    uint32_t last;
+};
+
+const CodePointRange ZERO_WIDTH[] = {
+    {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x05BF, 0x05BF}, {0x05C1, 0x05C2},
+    {0x05C4, 0x05C5}, {0x05C7, 0x05C7}, {0x0610, 0x061A}, {0x064B, 0x065F}, {0x0670, 0x0670},
+    {0x06D6, 0x06DC}, {0x06DF, 0x06E4}, {0x06E7, 0x06E8}, {0x06EA, 0x06ED}, {0x0711, 0x0711},
+    {0x0730, 0x074A}, {0x07A6, 0x07B0}, {0x0900, 0x0902}, {0x093A, 0x093A}, {0x093C, 0x093C},
+    {0x0941, 0x0948}, {0x094D, 0x094D}, {0x0951, 0x0957}, {0x0962, 0x0963}, {0x0981, 0x0981},
+    {0x09BC, 0x09BC}, {0x09C1, 0x09C4}, {0x09CD, 0x09CD}, {0x0A01, 0x0A02}, {0x0A3C, 0x0A3C},
+    {0x0A41, 0x0A51}, {0x0A70, 0x0A71}, {0x0E31, 0x0E31}, {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E},
+    {0x0EB1, 0x0EB1}, {0x0EB4, 0x0EBC}, {0x0EC8, 0x0ECD}, {0x1AB0, 0x1AFF}, {0x1DC0, 0x1DFF},
+    {0x200B, 0x200F}, {0x202A, 0x202E}, {0x2060, 0x2064}, {0x20D0, 0x20FF}, {0x302A, 0x302D},
+    {0x3099, 0x309A}, {0xFE00, 0xFE0F}, {0xFE20, 0xFE2F}, {0xFEFF, 0xFEFF}, {0x1F3FB, 0x1F3FF},
+    {0xE0001, 0xE007F}, {0xE0100, 0xE01EF},
+};
+
+const CodePointRange DOUBLE_WIDTH[] = {
+    {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC}, {0x23F0, 0x23F0},
+    {0x23F3, 0x23F3}, {0x25FD, 0x25FE}, {0x2614, 0x2615}, {0x2648, 0x2653}, {0x267F, 0x267F},
+    {0x2693, 0x2693}, {0x26A1, 0x26A1}, {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5},
+    {0x26CE, 0x26CE}, {0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5},
+    {0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B}, {0x2728, 0x2728},
+    {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755}, {0x2757, 0x2757}, {0x2795, 0x2797},
+    {0x27B0, 0x27B0}, {0x27BF, 0x27BF}, {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55},
+    {0x2E80, 0x3029}, {0x302E, 0x303E}, {0x3041, 0x3098}, {0x309B, 0x33FF}, {0x3400, 0x4DBF},
+    {0x4E00, 0x9FFF}, {0xA000, 0xA4CF}, {0xA960, 0xA97F}, {0xAC00, 0xD7A3}, {0xF900, 0xFAFF},
+    {0xFE10, 0xFE19}, {0xFE30, 0xFE6F}, {0xFF00, 0xFF60}, {0xFFE0, 0xFFE6}, {0x16FE0, 0x16FE4},
+    {0x17000, 0x18AFF}, {0x1B000, 0x1B2FF}, {0x1F004, 0x1F004}, {0x1F0CF, 0x1F0CF}, {0x1F18E, 0x1F18E},
+    {0x1F191, 0x1F19A}, {0x1F200, 0x1F202}, {0x1F210, 0x1F23B}, {0x1F240, 0x1F248}, {0x1F250, 0x1F251},
+    {0x1F260, 0x1F265}, {0x1F300, 0x1F320}, {0x1F32D, 0x1F335}, {0x1F337, 0x1F37C}, {0x1F37E, 0x1F393},
+    {0x1F3A0, 0x1F3CA}, {0x1F3CF, 0x1F3D3}, {0x1F3E0, 0x1F3F0}, {0x1F3F4, 0x1F3F4}, {0x1F3F8, 0x1F3FA},
+    {0x1F400, 0x1F43E}, {0x1F440, 0x1F440}, {0x1F442, 0x1F4FC}, {0x1F4FF, 0x1F53D}, {0x1F54B, 0x1F54E},
+    {0x1F550, 0x1F567}, {0x1F57A, 0x1F57A}, {0x1F595, 0x1F596}, {0x1F5A4, 0x1F5A4}, {0x1F5FB, 0x1F64F},
+    {0x1F680, 0x1F6C5}, {0x1F6CC, 0x1F6CC}, {0x1F6D0, 0x1F6D2}, {0x1F6D5, 0x1F6D7}, {0x1F6EB, 0x1F6EC},
+    {0x1F6F4, 0x1F6FC}, {0x1F7E0, 0x1F7EB}, {0x1F90C, 0x1F93A}, {0x1F93C, 0x1F945}, {0x1F947, 0x1F9FF},
+    {0x1FA70, 0x1FAFF}, {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD},
+};
+
+template <size_t N>
+static bool inRanges(uint32_t c, const CodePointRange (&ranges)[N]) {
+    const CodePointRange* it = std::upper_bound(ranges, ranges + N, c,
+        [](uint32_t c, const CodePointRange& range) { return c < range.first; });
+    return it != ranges && c <= (it - 1)->last;
+}
+
+uint32_t decodeUtf8(std::string_view s, size_t i, size_t* length) {
+    *length = 1;
+    unsigned char lead = s[i];
+    if (lead < 0x80)
+        return lead;
+    size_t n;
+    uint32_t c, min;
+    if ((lead & 0xE0) == 0xC0) {
+        n = 2; c = lead & 0x1F; min = 0x80;
+    } else if ((lead & 0xF0) == 0xE0) {
+        n = 3; c = lead & 0x0F; min = 0x800;
+    } else if ((lead & 0xF8) == 0xF0) {
+        n = 4; c = lead & 0x07; min = 0x10000;
+    } else {
+        return INVALID_UTF8;
+    }
+    if (s.length() - i < n)
+        return INVALID_UTF8;
+    for (size_t k = 1; k < n; k++) {
+        unsigned char next = s[i + k];
+        if ((next & 0xC0) != 0x80)
+            return INVALID_UTF8;
+        c = (c << 6) | (next & 0x3F);
+    }
+    // Overlong encodings and surrogates aren't valid either
+    if (c < min || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF))
+        return INVALID_UTF8;
+    *length = n;
+    return c;
+}
+
+int codePointWidth(uint32_t c) {
+    if (c < 0x300)
+        return 1;
+    if (inRanges(c, ZERO_WIDTH))
+        return 0;
+    return inRanges(c, DOUBLE_WIDTH) ? 2 : 1;
+}
+
+size_t asciiPrefix(std::string_view s) {
+    size_t i = 0;
+#ifdef __SSE2__
+    // The top bit of every byte at once
+    for (; s.length() - i >= 16; i += 16) {
+        int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) (s.data() + i)));
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+    for (; s.length() - i >= 8; i += 8) {
+        uint64_t word;
+        memcpy(&word, s.data() + i, 8);
+        if (word & 0x8080808080808080ull)
+            break;
+    }
+    while (i < s.length() && (unsigned char) s[i] < 0x80)
+        i++;
+    return i;
+}
+
+bool endsMidChar(std::string_view s) {
+    // Look back for the byte that starts the last char
+    for (size_t back = 1; back <= 4 && back <= s.length(); back++) {
+        unsigned char c = s[s.length() - back];
+        if ((c & 0xC0) == 0x80)
+            continue;
+        size_t length = c >= 0xF8 ? 1 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        return length > back;
+    }
+    return false;
+}
+
+void popChar(std::string& s) {
+    for (int i = 0; i < 3 && !s.empty() && ((unsigned char) s.back() & 0xC0) == 0x80; i++)
+        s.pop_back();
+    if (!s.empty())
+        s.pop_back();
+}
+
+LineColumns::LineColumns(std::string_view line) : bytes(line.length()) {
+    size_t i = 0, col = 0;
+    while (true) {
+        size_t ascii = asciiPrefix(line.substr(i));
+        i += ascii;
+        col += ascii;
+        if (i >= line.length() || i > UINT32_MAX - 4)
+            break;
+        size_t length;
+        uint32_t c = decodeUtf8(line, i, &length);
+        int width = c == INVALID_UTF8 ? 1 : codePointWidth(c);
+        chars.push_back({(uint32_t) i, (uint32_t) col, (uint8_t) length, (uint8_t) width});
+        i += length;
+        col += width;
+    }
+    columns = col + (line.length() - std::min(i, line.length()));
+}
+
+long LineColumns::charBefore(size_t offset) const {
+    auto it = std::upper_bound(chars.begin(), chars.end(), offset,
+        [](size_t offset, const Char& c) { return offset < c.offset; });
+    return (it - chars.begin()) - 1;
+}
+
+long LineColumns::charAtColumn(size_t col) const {
+    auto it = std::upper_bound(chars.begin(), chars.end(), col,
+        [](size_t col, const Char& c) { return col < c.column; });
+    return (it - chars.begin()) - 1;
+}
+
+size_t LineColumns::column(size_t offset) const {
+    offset = std::min(offset, bytes);
+    long k = charBefore(offset);
+    if (k < 0)
+        return offset;
+    const Char& c = chars[k];
+    if (offset < c.offset + c.length)
+        return c.column;
+    return c.column + c.width + (offset - c.offset - c.length);
+}
+
+size_t LineColumns::offsetAt(size_t col) const {
+    if (col >= columns)
+        return bytes;
+    long k = charAtColumn(col);
+    if (k < 0)
+        return col;
+    const Char& c = chars[k];
+    if (col < c.column + c.width)
+        return c.offset;
+    return c.offset + c.length + (col - c.column - c.width);
+}
+
+size_t LineColumns::charStart(size_t offset) const {
+    long k = charBefore(offset);
+    if (k >= 0 && offset < chars[k].offset + chars[k].length)
+        return chars[k].offset;
+    return offset;
+}
+
+bool LineColumns::isMarkAt(size_t offset) const {
+    long k = charBefore(offset);
+    return k >= 0 && chars[k].offset == offset && chars[k].width == 0;
+}
+
+size_t LineColumns::next(size_t offset) const {
+    if (offset >= bytes)
+        return bytes;
+    long k = charBefore(offset);
+    size_t next = k >= 0 && offset < chars[k].offset + chars[k].length ? chars[k].offset + chars[k].length : offset + 1;
+    while (next < bytes && isMarkAt(next)) {
+        const Char& mark = chars[charBefore(next)];
+        next = mark.offset + mark.length;
+    }
+    return next;
+}
+
+size_t LineColumns::prev(size_t offset) const {
+    if (offset == 0)
+        return 0;
+    size_t prev = charStart(std::min(offset, bytes) - 1);
+    while (prev > 0 && isMarkAt(prev))
+        prev = charStart(prev - 1);
+    return prev;
+}
+
+void LineColumns::resize(size_t length) {
+    bytes = length;
+    columns = length;
+}
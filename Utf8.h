@@ -0,0 +1,79 @@
+/*
+ * UTF-8 decoding and display widths, for mapping between the byte offsets
+ * that buffers use for columns and the columns text takes up on screen.
+ * Bytes that aren't part of a valid UTF-8 sequence count as one char each,
+ * one column wide, so that any file can still be edited.
+ * LineColumns maps one line. ASCII runs are skipped 16 bytes at a time, and
+ * only the chars that aren't ASCII are recorded, so a mostly ASCII line
+ * costs little to map and keep.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Returned by decodeUtf8 for a byte that doesn't start a valid char
+const uint32_t INVALID_UTF8 = 0xFFFFFFFF;
+
+// Decodes the char starting at s[i], setting `length` to its number of bytes
+// (1 for an invalid byte)
+uint32_t decodeUtf8(std::string_view s, size_t i, size_t* length);
+// Number of columns a code point takes on screen: 0 for combining marks,
+// 2 for wide (East Asian and emoji) ones, and 1 for everything else
+int codePointWidth(uint32_t c);
+// Number of bytes at the start of `s` before the first one that isn't ASCII
+size_t asciiPrefix(std::string_view s);
+// Whether `s` ends with the first bytes of a char whose other bytes are
+// missing (e.g. still on their way from the terminal)
+bool endsMidChar(std::string_view s);
+// Removes the last char of `s`
+void popChar(std::string& s);
+
+class LineColumns {
+    public:
+        LineColumns() = default;
+        // Maps a line, not including its newline
+        explicit LineColumns(std::string_view line);
+        // Bytes and columns in the whole line
+        size_t length() const { return bytes; }
+        size_t width() const { return columns; }
+        bool isAscii() const { return chars.empty(); }
+        // Column at which the char containing byte `offset` starts
+        size_t column(size_t offset) const;
+        // Offset of the char covering `col`, or the length of the line if
+        // it is shorter than that
+        size_t offsetAt(size_t col) const;
+        // Offset of the char after, or before, the one containing `offset`.
+        // Combining marks are skipped along with the char they belong to.
+        size_t next(size_t offset) const;
+        size_t prev(size_t offset) const;
+        // Adjusts an ASCII line's length after ASCII text without newlines
+        // was inserted or deleted in it, which doesn't change the mapping
+        void resize(size_t length);
+    private:
+        // A char that isn't ASCII (or an invalid byte). Bytes between such
+        // chars are ASCII, one column each. Lines past 4 GB are only mapped
+        // up to there, and treated as ASCII after it.
+        struct Char {
+            uint32_t offset;
+            uint32_t column;
+            uint8_t length;
+            uint8_t width;
+        };
+
+        size_t bytes = 0;
+        size_t columns = 0;
+        std::vector<Char> chars;
+
+        // Index of the last recorded char starting at or before `offset`
+        // (or column `col`), or -1 if there is none
+        long charBefore(size_t offset) const;
+        long charAtColumn(size_t col) const;
+        // Offset of the char containing `offset`
+        size_t charStart(size_t offset) const;
+        // Whether a combining mark (a char of no width) starts at `offset`
+        bool isMarkAt(size_t offset) const;
+};
@@ -1,6 +1,6 @@
 #include "Utils.h"
 
-int getCleanStrLen(const std::string& s) {
+int getCleanStrLen(std::string_view s) {
     int len = s.length();
     if (len == 0)
         return 0;
@@ -1,8 +1,19 @@
 #pragma once
 
-#include <sstream>
+#include <string_view>
+#include <thread>
+#include <vector>
 
-// Global debug log stream, defined in tekst.cpp
-extern std::ostringstream debugLog;
+int getCleanStrLen(std::string_view s);
 
-int getCleanStrLen(const std::string& s);
\ No newline at end of file
+// Calls f(i) for every i in [0, count) on its own thread, and waits for all to finish
+template <typename F>
+void parallelFor(size_t count, F f) {
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < count; i++)
+        threads.emplace_back(f, i);
+    if (count > 0)
+        f(0);
+    for (std::thread& t : threads)
+        t.join();
+}
\ No newline at end of file
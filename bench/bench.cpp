@@ -0,0 +1,417 @@
+/*
+ * Headless benchmark comparing the text buffer implementations.
+ * Every BufferType is driven through Buffer::createBuffer on generated files,
+ * and results are printed as one JSON object per line (throughput, latency
+ * percentiles and peak memory), so runs can be compared with other tools.
+ * Doesn't depend on curses. See README for building and options.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Buffer.h"
+#include "Finder.h"
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+const std::vector<BufferType> ALL_TYPES = {
+    BufferType::ArrayBufferType,
+    BufferType::ArrayArrayBufferType,
+    BufferType::PieceTableBufferType,
+    BufferType::RopeBufferType,
+    BufferType::GapBufferType,
+    BufferType::PagedBufferType,
+};
+
+struct Options {
+    std::vector<size_t> sizes = {1 << 20, 16 << 20, 128 << 20};
+    std::vector<BufferType> types = ALL_TYPES;
+    std::string dir = "/tmp/tekst-bench";
+    // Number of operations in each edit group (reads do 10x as many)
+    int ops = 200;
+    // Maximum seconds spent in one group of operations, so slow
+    // implementations on huge files still finish
+    double budget = 10;
+    unsigned seed = 1;
+};
+
+using Clock = std::chrono::steady_clock;
+
+double elapsedNs(Clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+// Parses sizes like "512K", "16M" or "2G"
+size_t parseSize(const std::string& s) {
+    size_t n = std::stoull(s);
+    switch (s.back()) {
+        case 'K': case 'k': return n << 10;
+        case 'M': case 'm': return n << 20;
+        case 'G': case 'g': return n << 30;
+        default: return n;
+    }
+}
+
+std::vector<std::string> split(const std::string& s, char delim) {
+    std::vector<std::string> parts;
+    std::istringstream stream(s);
+    std::string part;
+    while (getline(stream, part, delim))
+        parts.push_back(part);
+    return parts;
+}
+
+// Generates a file of roughly `size` bytes of log-like lines of varying length,
+// or reuses one from a previous run. Returns the number of lines.
+size_t generateFile(const std::string& path, size_t size, unsigned seed) {
+    std::ifstream existing(path, std::ios::binary | std::ios::ate);
+    if (!existing.is_open() || (size_t) existing.tellg() != size) {
+        std::ofstream out(path, std::ios::binary | std::ofstream::trunc);
+        if (!out.is_open())
+            throw std::string("Unable to write to file: ") + path;
+        const char* words[] = {"INFO", "WARN", "request", "completed", "worker", "connection",
+            "timeout", "cache", "miss", "user", "session", "GET", "/api/v1/items", "200", "ms"};
+        std::mt19937 rng(seed);
+        std::string chunk;
+        size_t written = 0;
+        while (written < size) {
+            std::string line = "2021-07-18 12:" + std::to_string(rng() % 60) + ":" + std::to_string(rng() % 60);
+            size_t wordCount = 3 + rng() % 15;
+            for (size_t i = 0; i < wordCount; i++) {
+                line += ' ';
+                line += words[rng() % (sizeof(words) / sizeof(words[0]))];
+            }
+            line += '\n';
+            line.resize(std::min(line.length(), size - written));
+            if (written + line.length() == size)
+                line.back() = '\n';
+            chunk += line;
+            written += line.length();
+            if (chunk.length() >= (1 << 20) || written == size) {
+                out.write(chunk.data(), chunk.length());
+                chunk.clear();
+            }
+        }
+    }
+    // Count lines of (possibly reused) file
+    std::ifstream in(path, std::ios::binary);
+    std::vector<char> block(1 << 20);
+    size_t lines = 0;
+    while (in.read(block.data(), block.size()) || in.gcount() > 0)
+        lines += std::count(block.begin(), block.begin() + in.gcount(), '\n');
+    return lines;
+}
+
+// Times `count` calls of `op`, stopping early if the time budget runs out.
+// Returns the duration of each call in nanoseconds.
+std::vector<double> timeOps(int count, double budget, const std::function<void(int)>& op) {
+    std::vector<double> samples;
+    samples.reserve(count);
+    double total = 0;
+    for (int i = 0; i < count && total < budget * 1e9; i++) {
+        Clock::time_point start = Clock::now();
+        op(i);
+        samples.push_back(elapsedNs(start));
+        total += samples.back();
+    }
+    return samples;
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty())
+        return 0;
+    return sorted[std::min(sorted.size() - 1, (size_t) (p * sorted.size()))];
+}
+
+void report(BufferType type, size_t size, const std::string& op, std::vector<double> samples, double bytes = 0) {
+    std::sort(samples.begin(), samples.end());
+    double total = 0;
+    for (double s : samples)
+        total += s;
+    printf("{\"type\":\"%s\",\"size\":%zu,\"op\":\"%s\",\"count\":%zu,\"total_ms\":%.3f,\"ops_per_s\":%.1f",
+        Buffer::bufferTypeToString(type).c_str(), size, op.c_str(), samples.size(),
+        total / 1e6, total > 0 ? samples.size() / (total / 1e9) : 0);
+    if (bytes > 0)
+        printf(",\"mb_per_s\":%.1f", total > 0 ? bytes / (1 << 20) / (total / 1e9) : 0);
+    printf(",\"p50_us\":%.3f,\"p90_us\":%.3f,\"p99_us\":%.3f,\"max_us\":%.3f}\n",
+        percentile(samples, 0.5) / 1e3, percentile(samples, 0.9) / 1e3,
+        percentile(samples, 0.99) / 1e3, samples.empty() ? 0 : samples.back() / 1e3);
+    fflush(stdout);
+}
+
+long peakRssKb() {
+#ifdef _WIN32
+    return -1;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+#endif
+}
+
+// Runs every benchmark against one buffer type on one file
+void runBenchmarks(BufferType type, std::string path, size_t size, size_t lines, const Options& opts) {
+    std::unique_ptr<Buffer> b;
+    std::vector<double> open = timeOps(1, opts.budget, [&](int) {
+        b = Buffer::createBuffer(type, &path[0]);
+    });
+    report(type, size, "open", open, size);
+
+    std::mt19937 rng(opts.seed);
+    // Reading lines in order, like scrolling through the file
+    report(type, size, "getline_sequential", timeOps(opts.ops * 10, opts.budget, [&](int i) {
+        b->getLine(i % lines);
+    }));
+    report(type, size, "getline_random", timeOps(opts.ops * 10, opts.budget, [&](int) {
+        b->getLine(rng() % lines);
+    }));
+    // Viewing a screenful of lines at a time, like redrawing the editor
+    report(type, size, "visit_screen", timeOps(opts.ops * 10, opts.budget, [&](int) {
+        b->visitLines(rng() % lines, 50, [](uint, std::string_view) {});
+    }));
+
+    // Read-only buffers ignore edits, so timing them would mean nothing
+    if (!b->isReadOnly()) {
+        // Typing runs of characters, like a user would
+        const std::pair<const char*, size_t> positions[] = {
+            {"type_start", 0}, {"type_middle", lines / 2}, {"type_end", lines}};
+        for (auto& position : positions) {
+            report(type, size, position.first, timeOps(opts.ops, opts.budget, [&](int i) {
+                b->insertChar('x', position.second, i);
+            }));
+        }
+
+        // Splitting and rejoining random lines
+        report(type, size, "newline_storm", timeOps(opts.ops, opts.budget, [&](int) {
+            size_t line = rng() % lines;
+            b->insertChar('\n', line, 1);
+            b->delChar(line, 1);
+        }));
+
+        // Pasting a block of lines and deleting it again
+        std::string block;
+        while (block.length() < (64 << 10))
+            block += "pasted line of text " + std::to_string(block.length()) + "\n";
+        std::vector<size_t> pasted;
+        report(type, size, "paste_64k", timeOps(opts.ops / 10 + 1, opts.budget, [&](int) {
+            pasted.push_back(rng() % lines);
+            b->insertText(pasted.back(), 0, block);
+        }), (opts.ops / 10 + 1) * block.length());
+        report(type, size, "delete_range_64k", timeOps(pasted.size(), opts.budget, [&](int i) {
+            b->deleteRange(pasted[pasted.size() - 1 - i], 0, block.length());
+        }), pasted.size() * block.length());
+        // Undoing the deletes, each of which is one edit in the history
+        report(type, size, "undo_64k", timeOps(pasted.size(), opts.budget, [&](int) {
+            int line, col;
+            b->undo(&line, &col);
+        }), pasted.size() * block.length());
+    }
+
+    // Taking a snapshot is the part of saving that blocks editing
+    report(type, size, "snapshot", timeOps(1, opts.budget, [&](int) {
+        b->snapshot();
+    }), size);
+
+    // Searching the whole file for a word that is on most lines
+    report(type, size, "find_all", timeOps(1, opts.budget, [&](int) {
+        Finder finder;
+        finder.start(b->snapshot(), "timeout");
+        while (!finder.finished())
+            std::this_thread::yield();
+    }), size);
+
+    // Save to a separate file so the generated one can be reused
+    b->filename = path + ".saved";
+    report(type, size, "save", timeOps(1, opts.budget, [&](int) {
+        b->save();
+    }), size);
+    std::remove(b->filename.c_str());
+
+    printf("{\"type\":\"%s\",\"size\":%zu,\"op\":\"summary\",\"lines\":%zu,\"peak_rss_kb\":%ld}\n",
+        Buffer::bufferTypeToString(type).c_str(), size, lines, peakRssKb());
+    fflush(stdout);
+}
+
+// Checks run with --check instead of the benchmarks, for bugs that leave
+// the text wrong rather than slow. Each one opens a buffer of every type on
+// a small file, and returns an error message, or an empty string if the
+// buffer is as expected.
+using Check = std::function<std::string(Buffer* b, const std::string& path)>;
+
+// Lines "line0\n" to "line<count - 1>\n"
+std::string numberedLines(int count) {
+    std::string text;
+    for (int i = 0; i < count; i++)
+        text += "line" + std::to_string(i) + "\n";
+    return text;
+}
+
+std::string expectLine(Buffer* b, uint lineNum, const std::string& expected) {
+    std::optional<std::string> line = b->getLine(lineNum);
+    if (line == expected)
+        return "";
+    return "line " + std::to_string(lineNum) + " is \"" + line.value_or("(none)") + "\"";
+}
+
+std::string expectLineCount(Buffer* b, uint expected) {
+    if (b->lineCount() == expected)
+        return "";
+    return std::to_string(b->lineCount()) + " lines instead of " + std::to_string(expected);
+}
+
+const std::vector<std::pair<std::string, Check>> CHECKS = {
+    // Line feeds before the edited piece used to be left out of the count
+    {"line_count_after_edit", [](Buffer* b, const std::string&) {
+        b->insertChar('X', 5, 0);
+        std::string error = expectLineCount(b, 11);
+        return error.empty() ? expectLine(b, 5, "Xline5\n") : error;
+    }},
+    // Which -f relies on to append to the end rather than mid-file
+    {"append_after_edit", [](Buffer* b, const std::string&) {
+        b->insertChar('X', 5, 0);
+        b->appendText("appended\n");
+        std::string error = expectLineCount(b, 12);
+        return error.empty() ? expectLine(b, 10, "appended\n") : error;
+    }},
+#ifndef _WIN32
+    // Saving replaces the file with a new one, which used to get the default mode
+    {"save_keeps_mode", [](Buffer* b, const std::string& path) {
+        chmod(path.c_str(), 0600);
+        b->insertChar('X', 5, 0);
+        b->save();
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0 || (st.st_mode & 07777) != 0600)
+            return std::string("mode isn't 0600 after saving");
+        return std::string();
+    }},
+    // And used to replace the link with a regular file
+    {"save_through_symlink", [](Buffer* b, const std::string& path) {
+        std::string link = path + ".link";
+        remove(link.c_str());
+        if (symlink(path.c_str(), link.c_str()) != 0)
+            return std::string("unable to create link");
+        b->filename = link;
+        b->insertChar('X', 5, 0);
+        b->save();
+        struct stat st;
+        bool isLink = lstat(link.c_str(), &st) == 0 && S_ISLNK(st.st_mode);
+        remove(link.c_str());
+        if (!isLink)
+            return std::string("link was replaced by a file");
+        std::string target = path;
+        std::unique_ptr<Buffer> saved = Buffer::createBuffer(BufferType::ArrayBufferType, &target[0]);
+        return expectLine(saved.get(), 5, "Xline5\n");
+    }},
+#endif
+};
+
+// Runs every check against every type of buffer that can be edited, printing
+// one JSON object for each. Returns the number of checks that failed.
+int runChecks(const Options& opts) {
+    int failed = 0;
+    std::string path = opts.dir + "/tekst-check.txt";
+    for (const auto& [name, check] : CHECKS) {
+        for (BufferType type : opts.types) {
+            std::string error;
+            try {
+                std::ofstream(path, std::ios::binary | std::ofstream::trunc) << numberedLines(10);
+                std::unique_ptr<Buffer> b = Buffer::createBuffer(type, &path[0]);
+                if (b->isReadOnly())
+                    continue;
+                error = check(b.get(), path);
+            } catch (std::string msg) {
+                error = msg;
+            }
+            printf("{\"type\":\"%s\",\"check\":\"%s\",\"ok\":%s",
+                Buffer::bufferTypeToString(type).c_str(), name.c_str(), error.empty() ? "true" : "false");
+            if (!error.empty())
+                printf(",\"error\":\"%s\"", error.c_str());
+            printf("}\n");
+            failed += !error.empty();
+        }
+    }
+    remove(path.c_str());
+    return failed;
+}
+
+int main(int argc, char* argv[]) {
+    Options opts;
+    bool check = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        std::string value = i + 1 < argc ? argv[i + 1] : "";
+        if (arg == "--check") {
+            check = true;
+            continue;
+        } else if (arg == "--sizes") {
+            opts.sizes.clear();
+            for (const std::string& s : split(value, ','))
+                opts.sizes.push_back(parseSize(s));
+        } else if (arg == "--types") {
+            opts.types.clear();
+            for (const std::string& s : split(value, ','))
+                opts.types.push_back(Buffer::bufferTypeFromString(s));
+        } else if (arg == "--dir") {
+            opts.dir = value;
+        } else if (arg == "--ops") {
+            opts.ops = std::stoi(value);
+        } else if (arg == "--budget") {
+            opts.budget = std::stod(value);
+        } else if (arg == "--seed") {
+            opts.seed = std::stoul(value);
+        } else {
+            fprintf(stderr, "bench [--sizes 1M,16M,1G] [--types ArrayBuffer,...] [--dir path]"
+                " [--ops n] [--budget seconds] [--seed n] [--check]\n");
+            return 1;
+        }
+        i++;
+    }
+
+#ifndef _WIN32
+    mkdir(opts.dir.c_str(), 0755);
+#endif
+    if (check)
+        return runChecks(opts) > 0;
+    for (size_t size : opts.sizes) {
+        std::string path = opts.dir + "/tekst-bench-" + std::to_string(size) + ".txt";
+        size_t lines;
+        try {
+            lines = generateFile(path, size, opts.seed);
+        } catch (std::string msg) {
+            fprintf(stderr, "%s\n", msg.c_str());
+            return 1;
+        }
+        for (BufferType type : opts.types) {
+#ifdef _WIN32
+            runBenchmarks(type, path, size, lines, opts);
+#else
+            // Run each implementation in its own process so that peak memory
+            // and allocator state are measured independently
+            fflush(stdout);
+            pid_t pid = fork();
+            if (pid == 0) {
+                runBenchmarks(type, path, size, lines, opts);
+                _exit(0);
+            }
+            int status;
+            waitpid(pid, &status, 0);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                fprintf(stderr, "%s failed on %zu bytes\n", Buffer::bufferTypeToString(type).c_str(), size);
+#endif
+        }
+    }
+    return 0;
+}
@@ -1,96 +1,350 @@
 #include <algorithm>
+#include <clocale>
+#include <cstdlib>
 #include <curses.h>
+#include <fstream>
 #include <iostream>
-#include <optional>
 #include <signal.h>
 #include <string>
+#include <string_view>
 #include <vector>
 #include "Buffer.h"
-#include "Utils.h"
-
-// While in curses terminal mode can't print to std::cout so keeping
-// a tmp stream and printing at termination.
-// Variable is extern declared in Utils.h for global usage.
-std::ostringstream debugLog;
+#include "ColumnCache.h"
+#include "EditJournal.h"
+#include "EditorServer.h"
+#include "FileFollower.h"
+#include "FileSaver.h"
+#include "Finder.h"
+#include "LinePrefetcher.h"
+#include "MatchIndex.h"
+#include "PagedBuffer.h"
+#include "RemoteBuffer.h"
+#include "Trace.h"
+#include "Utf8.h"
 
 // Macro for checking CTRL + KEY presses
 #define ctrl(x) ((x) & 0x1f)
 // Number of lines in text edit region (excludes header and footer)
 #define LINES_TXT LINES - 2
 #define COLS_TXT COLS - 4
+// Where the trace is written on exit with -d
+#define TRACE_FILE "tekst-trace.log"
+// How often the footer is updated while saving or searching in the background
+#define POLL_MS 100
+#define ESCAPE_KEY 27
+
+// What the view knows about a line it is displaying. The text itself is
+// only read from the Buffer while drawing, so it isn't copied into here.
+struct ViewLine {
+    bool exists = false; // False for rows past the end of the file
+    int length = 0; // Length of the whole line excluding the newline, even if cut off
+    bool hasNewline = false;
+    bool dirty = false; // Whether the row has to be drawn again
+};
 
-// Table of lines / strings that are currently within the editor's view.
-// This is the viewer's text memory, not to be confused with Buffer's complete text memory.
-// Lines out of range have an empty optional.
-std::vector<std::optional<std::string>> linesInView;
+// Table of lines that are currently within the editor's view, one per row.
+// This is the viewer's memory, not to be confused with Buffer's complete text memory.
+// Entries are kept in a ring keyed by file line (line L is in slot L % rows),
+// so scrolling only replaces the entry of the line scrolled into view.
+// Lines are shown from column leftCol(). Columns of the view are columns on
+// screen, while the cursor's column and line lengths are in bytes, which
+// differ for text that isn't ASCII (see ColumnCache).
+class ViewRing {
+    public:
+        // Sets the size of the view, keeping the entries of lines that are
+        // still in view. The other rows are empty and dirty.
+        void resize(int rows, int cols) {
+            std::vector<ViewLine> old(rows, ViewLine{false, 0, false, true});
+            for (int row = 0; row < std::min(rows, (int) slots.size()); row++)
+                old[(firstLine + row) % rows] = (*this)[row];
+            slots.swap(old);
+            width = cols;
+        }
+        int rows() const { return slots.size(); }
+        int cols() const { return width; }
+        int leftCol() const { return firstCol; }
+        // Scrolls sideways. Every row has to be drawn again.
+        void setLeftCol(int col) { firstCol = col; }
+        ViewLine& operator[](int row) { return slots[(firstLine + row) % slots.size()]; }
+        // Moves the view to start at `line`, keeping the entries of lines
+        // still in view. Rows of lines scrolled into view are cleared.
+        void scrollTo(int line) {
+            int shift = std::min(std::abs(line - firstLine), rows());
+            int firstNew = line > firstLine ? rows() - shift : 0;
+            firstLine = line;
+            for (int row = firstNew; row < firstNew + shift; row++)
+                (*this)[row] = ViewLine();
+        }
+        // Shifts the entries from `row` down by one row, for a line inserted
+        // above them, and clears the entry at `row`
+        void insertRow(int row) {
+            for (int r = rows() - 1; r > row; r--)
+                (*this)[r] = (*this)[r - 1];
+            (*this)[row] = ViewLine();
+        }
+        // Shifts the entries below `row` up by one row, for the line at
+        // `row` being removed, and clears the bottom entry
+        void deleteRow(int row) {
+            for (int r = row; r < rows() - 1; r++)
+                (*this)[r] = (*this)[r + 1];
+            (*this)[rows() - 1] = ViewLine();
+        }
+    private:
+        std::vector<ViewLine> slots;
+        int firstLine = 0;
+        int width = 0;
+        int firstCol = 0;
+};
+
+ViewRing linesInView;
 
 // Curses windows for specific regions of the UI.
 WINDOW* txtW; // Where textfile contents are displayed and edited
 WINDOW* headW; // Top margin of UI
 WINDOW* footW; // Bottom margin of UI
 WINDOW* lineNumW; // Left margin of UI
+// Keys are read from this window, which is never drawn to. Reading from a
+// modified window repaints it first, which would defeat batching the
+// repaints of txtW.
+WINDOW* inputW;
 
-// Displays desired text line from file in target row.
-// Note that this method moves the cursor.
-void displayLineFromBuffer(int fileLineNum, int displayRow, Buffer* b) {
-    // Get line from buffer in memory
-    std::optional<std::string> line = b->getLine(fileLineNum);    
-    if (line.has_value()) {
-        /// TODO: Limit number of characters according to COLS?
-        // If this line is being displayed in last row of text edit region, strip
-        // the newline when printing or else curses will shift lines up and add blank line.
-        bool hasNewline = line->length() > 0 && line->back() == '\n';
-        if (displayRow == LINES_TXT - 1 && hasNewline) {
-            mvwaddstr(txtW, displayRow, 0,
-                line->substr(0, line->length() - 1).c_str());
-        } else {
-            mvwaddstr(txtW, displayRow, 0, line->c_str());
+// Caches the lines around the view, which are drawn from it
+LinePrefetcher* prefetcher;
+// Maps between bytes and screen columns of lines the cursor has been on
+ColumnCache* columns;
+// Journal of unsaved edits, if there is one, and its position at the
+// snapshot being saved
+EditJournal* journal = nullptr;
+uint64_t journalSaveMark = 0;
+// Set if the buffer is held by a server (see main), and the version of its
+// text being saved
+RemoteBuffer* remote = nullptr;
+uint64_t remoteSaveMark = 0;
+
+// Message shown on the right of the footer, e.g. save progress
+std::string footerStatus;
+// Whether the footer shows operation latencies instead (toggled with Ctrl+T)
+bool showStats = false;
+// Matches of the current search, which are highlighted
+MatchIndex* matchIndex = nullptr;
+
+// Highlights the matches in a row showing a given line, and clears any
+// highlights left over from before. Doesn't move the cursor.
+void highlightRow(int displayRow, uint lineNum) {
+    int cursorRow, cursorCol;
+    getyx(txtW, cursorRow, cursorCol);
+    mvwchgat(txtW, displayRow, 0, -1, A_NORMAL, 0, NULL);
+    if (matchIndex && !matchIndex->getQuery().empty()) {
+        const std::vector<Finder::Match>& matches = matchIndex->getMatches();
+        int left = linesInView.leftCol();
+        int length = matchIndex->getQuery().length();
+        // Only matches at least partly in view, cut to the part in view.
+        // A match can't end before its byte offset, which is at least its column.
+        for (size_t i = matchIndex->firstMatchFrom(lineNum, std::max(0, left - length + 1));
+                i < matches.size() && matches[i].line == lineNum; i++) {
+            const LineColumns& lineColumns = columns->get(lineNum);
+            int begin = lineColumns.column(matches[i].col);
+            int end = lineColumns.column(matches[i].col + length);
+            if (begin >= left + COLS_TXT)
+                break;
+            if (end <= left)
+                continue;
+            begin = std::max(begin, left);
+            mvwchgat(txtW, displayRow, begin - left, end - begin, A_STANDOUT, 0, NULL);
         }
-        
     }
-    // Update memory with newly loaded line
-    linesInView.insert(linesInView.begin() + displayRow, line);
+    wmove(txtW, cursorRow, cursorCol);
 }
 
-/// TODO: Handle inserting & deleting EOL cases with this method
-/// instead of above for efficiency
-void displayLineFromCache(int row) {
-    // Get line from view memory
-    if (linesInView[row].has_value()) {
-        mvwaddstr(txtW, row, 0, linesInView[row]->c_str());
+// Displays the part of a line that is in view (read from the buffer) in
+// target row, and records the line in view memory.
+// Note that this method moves the cursor.
+void drawLine(int displayRow, uint lineNum, const LineSlice& slice) {
+    // Cut the line to the columns in view. A wide char cut by the left edge
+    // shows as spaces, and one that doesn't fit at the right edge is left out.
+    static std::string shown;
+    shown.clear();
+    std::string_view text = slice.text;
+    size_t left = linesInView.leftCol();
+    size_t right = left + COLS_TXT;
+    size_t col = 0;
+    // Bytes and columns of the last char shown
+    size_t lastLength = 0, lastWidth = 0;
+    for (size_t i = 0; i < text.length() && col < right;) {
+        // Runs of ASCII are one column per byte
+        size_t ascii = asciiPrefix(text.substr(i, right - col));
+        if (ascii > 0) {
+            size_t skip = col < left ? std::min(ascii, left - col) : 0;
+            shown.append(text.substr(i + skip, ascii - skip));
+            if (ascii > skip)
+                lastLength = lastWidth = 1;
+            i += ascii;
+            col += ascii;
+            continue;
+        }
+        size_t length;
+        uint32_t c = decodeUtf8(text, i, &length);
+        size_t width = c == INVALID_UTF8 ? 1 : codePointWidth(c);
+        if (col + width > right)
+            break;
+        if (col >= left) {
+            // Invalid bytes can't be shown as they are
+            if (c == INVALID_UTF8)
+                shown.push_back('?');
+            else
+                shown.append(text.substr(i, length));
+            // Combining marks belong to the char before them
+            if (width > 0 || lastLength == 0) {
+                lastLength = c == INVALID_UTF8 ? 1 : length;
+                lastWidth = width;
+            } else {
+                lastLength += length;
+            }
+        } else if (col + width > left) {
+            shown.append(col + width - left, ' ');
+            lastLength = lastWidth = 1;
+        }
+        i += length;
+        col += width;
     }
+    // Writing to the last column of the bottom row would scroll the window,
+    // so the char there is inserted instead, which doesn't move the cursor
+    if (displayRow == LINES_TXT - 1 && col >= right && lastLength > 0) {
+        mvwinsnstr(txtW, displayRow, COLS_TXT - lastWidth, shown.data() + shown.length() - lastLength, lastLength);
+        shown.resize(shown.length() - lastLength);
+    }
+    mvwaddnstr(txtW, displayRow, 0, shown.data(), shown.length());
+    linesInView[displayRow] = {true, (int) slice.length, slice.hasNewline, false};
+    highlightRow(displayRow, lineNum);
 }
 
-void initDraw(Buffer* b, int scrollOffset) {
-    waddstr(headW, "tekst by Baran Usluel\n");
-    wnoutrefresh(headW);
+// Bytes of each line read to draw it. Lines are read from their start, since
+// the columns in view can't be found without reading the text before them,
+// and a column takes at most 4 bytes (except for combining marks).
+size_t sliceWidth() {
+    return (size_t) (linesInView.leftCol() + COLS_TXT) * 4;
+}
 
-    waddstr(footW, b->filename.c_str());
-    wnoutrefresh(footW);
+// Displays desired text line from file in target row.
+// Note that this method moves the cursor.
+void displayLineFromBuffer(int fileLineNum, int displayRow, Buffer* b) {
+    wmove(txtW, displayRow, 0);
+    wclrtoeol(txtW);
+    // Stays empty if the line is out of range
+    linesInView[displayRow] = ViewLine();
+    prefetcher->visitLineSlices(fileLineNum, 1, 0, sliceWidth(), [displayRow](uint lineNum, const LineSlice& slice) {
+        drawLine(displayRow, lineNum, slice);
+    });
+}
 
+// Displays text from file in rows from `firstRow` to the bottom of the
+// text view, fetched from the buffer as one range.
+void displayLinesFromBuffer(int scrollOffset, int firstRow, Buffer* b) {
+    wmove(txtW, firstRow, 0);
+    wclrtobot(txtW);
+    // Rows stay empty if their lines are out of range
+    linesInView.scrollTo(scrollOffset);
+    for (int row = firstRow; row < LINES_TXT; row++)
+        linesInView[row] = ViewLine();
+    prefetcher->visitLineSlices(scrollOffset + firstRow, LINES_TXT - firstRow, 0, sliceWidth(),
+        [scrollOffset](uint lineNum, const LineSlice& slice) {
+            drawLine(lineNum - scrollOffset, lineNum, slice);
+        });
+}
+
+// Updates the highlighted matches in every row
+void highlightView(int scrollOffset) {
+    for (int row = 0; row < LINES_TXT; row++) {
+        if (linesInView[row].exists)
+            highlightRow(row, row + scrollOffset);
+    }
+}
+
+void drawLineNums(int scrollOffset) {
+    werase(lineNumW);
     for (int i = 0; i < LINES_TXT; ++i) {
         wmove(lineNumW, i, 0);
         wprintw(lineNumW, "%u", i + 1 + scrollOffset);
     }
     wnoutrefresh(lineNumW);
+}
 
-    // Display text from read file in visible rows
-    for (int i = 0; i < LINES_TXT; ++i) {
-        displayLineFromBuffer(i + scrollOffset, i, b);
+// Draws the file name and status message in the footer
+void drawFooter(Buffer* b) {
+    werase(footW);
+    if (showStats) {
+        mvwaddnstr(footW, 0, 0, traceSummary().c_str(), COLS - 1);
+        wnoutrefresh(footW);
+        return;
     }
+    mvwaddstr(footW, 0, 0, b->filename.c_str());
+    if (!footerStatus.empty())
+        mvwaddstr(footW, 0, std::max(0, COLS - (int) footerStatus.length() - 1), footerStatus.c_str());
+    wnoutrefresh(footW);
+}
+
+void drawHeader() {
+    werase(headW);
+    waddstr(headW, "tekst by Baran Usluel\n");
+    wnoutrefresh(headW);
+}
+
+void initDraw(Buffer* b, int scrollOffset) {
+    drawHeader();
+
+    drawFooter(b);
+
+    drawLineNums(scrollOffset);
+
+    // Display text from read file in visible rows
+    linesInView.resize(LINES_TXT, COLS_TXT);
+    displayLinesFromBuffer(scrollOffset, 0, b);
     // wrefresh = wnoutrefresh + doupdate
     // When refreshing multiple windows, only doupdate once for efficiency
     wnoutrefresh(txtW);
     doupdate();
 }
 
-/// TODO: Optimize this by not fully clearing and redrawing
-void handleResize(Buffer* b, int scrollOffset) {
-    // Clear all windows
-    wclear(txtW);
-    wclear(headW);
-    wclear(footW);
-    wclear(lineNumW);
+// Draws the rows marked dirty again, fetching each run of them from the
+// buffer as one range
+void drawDirtyRows(int scrollOffset, Buffer* b) {
+    for (int row = 0; row < LINES_TXT;) {
+        if (!linesInView[row].dirty) {
+            row++;
+            continue;
+        }
+        int end = row;
+        for (; end < LINES_TXT && linesInView[end].dirty; end++) {
+            wmove(txtW, end, 0);
+            wclrtoeol(txtW);
+            // Stays empty if the line is out of range
+            linesInView[end] = ViewLine();
+        }
+        prefetcher->visitLineSlices(scrollOffset + row, end - row, 0, sliceWidth(),
+            [scrollOffset](uint lineNum, const LineSlice& slice) {
+                drawLine(lineNum - scrollOffset, lineNum, slice);
+            });
+        row = end;
+    }
+}
+
+// Resizes the windows to fit the terminal. Text that is still in view stays
+// on screen, and only rows that changed are drawn again: ones newly in view,
+// and ones with lines too long for the old or new width.
+void handleResize(Buffer* b, int& scrollOffset, int& row) {
+    // Curses has already cut the windows down to fit the terminal, so the
+    // width they had is only known from the view
+    int oldCols = linesInView.cols();
+    // If the cursor's row was cut off, scroll it up into view. The rows that
+    // were cut off are gone, so every row is drawn again.
+    int shift = std::max(0, row - (LINES_TXT - 1));
+    if (shift > 0) {
+        scrollOffset += shift;
+        row -= shift;
+        linesInView.scrollTo(scrollOffset);
+        for (int r = 0; r < linesInView.rows(); r++)
+            linesInView[r].dirty = true;
+    }
     // Resize all windows in memory
     wresize(txtW, LINES_TXT, COLS_TXT);
     wresize(headW, 1, COLS);
@@ -98,8 +352,20 @@ void handleResize(Buffer* b, int scrollOffset) {
     wresize(lineNumW, LINES_TXT, 4);
     // Move footer
     mvwin(footW, LINES - 1, 0);
-    // Redraw all contents
-    initDraw(b, scrollOffset);
+
+    linesInView.resize(LINES_TXT, COLS_TXT);
+    if (COLS_TXT != oldCols) {
+        for (int r = 0; r < LINES_TXT; r++) {
+            if (linesInView[r].exists && linesInView[r].length - linesInView.leftCol() >= std::min(oldCols, COLS_TXT))
+                linesInView[r].dirty = true;
+        }
+    }
+    drawHeader();
+    drawFooter(b);
+    drawLineNums(scrollOffset);
+    drawDirtyRows(scrollOffset, b);
+    wnoutrefresh(txtW);
+    doupdate();
 }
 
 void scrollLineNumsUp(const int& scrollOffset) {
@@ -121,8 +387,7 @@ void scrollTextViewUp(int& scrollOffset, Buffer* b, bool loadBottomLine) {
     curs_set(0); // Hide cursor during operations to avoid flickering
     wscrl(txtW, 1);
     scrollOffset++;
-    // Delete entry from start of table because only tracking visible lines
-    linesInView.erase(linesInView.begin());
+    linesInView.scrollTo(scrollOffset);
     // Load text to display in the new scrolled line.
     if (loadBottomLine)
         displayLineFromBuffer(LINES_TXT - 1 + scrollOffset, LINES_TXT - 1, b);
@@ -135,8 +400,7 @@ void scrollTextViewDown(int& scrollOffset, Buffer* b, bool loadTopLine) {
     curs_set(0); // Hide cursor during operations to avoid flickering
     wscrl(txtW, -1);
     scrollOffset--;
-    // Delete entry from end of table because only tracking visible lines
-    linesInView.erase(linesInView.end() - 1);
+    linesInView.scrollTo(scrollOffset);
     // Load text to display in the new scrolled line.
     if (loadTopLine)
         displayLineFromBuffer(scrollOffset, 0, b);
@@ -144,6 +408,34 @@ void scrollTextViewDown(int& scrollOffset, Buffer* b, bool loadTopLine) {
     curs_set(1);
 }
 
+// Moves the cursor to a column (in bytes) of the line in a row. If the column
+// is out of view, the view scrolls sideways to put it in the middle (or back
+// to the start of the line if it fits) and every row is drawn again.
+void moveCursorTo(int scrollOffset, Buffer* b, int row, int col) {
+    int x = columns->get(scrollOffset + row).column(col);
+    int left = linesInView.leftCol();
+    if (x < left || x >= left + COLS_TXT) {
+        linesInView.setLeftCol(x < COLS_TXT ? 0 : x - (COLS_TXT) / 2);
+        displayLinesFromBuffer(scrollOffset, 0, b);
+    }
+    wmove(txtW, row, x - linesInView.leftCol());
+}
+
+// Moves the cursor to the char containing byte `newCol` of the line in a row,
+// and makes the column it is shown at the one to keep to when moving up
+// and down
+void moveCursorToCol(int scrollOffset, Buffer* b, int row, int& col, int& colGoal, int newCol) {
+    const LineColumns& lineColumns = columns->get(scrollOffset + row);
+    colGoal = lineColumns.column(newCol);
+    col = lineColumns.offsetAt(colGoal);
+    moveCursorTo(scrollOffset, b, row, col);
+}
+
+// Byte of the line in a row that is shown at the column the cursor keeps to
+int colForGoal(int scrollOffset, int row, int colGoal) {
+    return columns->get(scrollOffset + row).offsetAt(colGoal);
+}
+
 bool moveCursorUp(int& scrollOffset, Buffer* b, int& row, int& col, int& colGoal) {
     if (row == 0) {
         // If no more lines above, stop
@@ -153,7 +445,7 @@ bool moveCursorUp(int& scrollOffset, Buffer* b, int& row, int& col, int& colGoal
     } else {
         row--;
     }
-    wmove(txtW, row, col = std::min(colGoal, getCleanStrLen(linesInView[row].value())));
+    moveCursorTo(scrollOffset, b, row, col = colForGoal(scrollOffset, row, colGoal));
     return true;
 }
 
@@ -162,16 +454,16 @@ bool moveCursorDown(int& scrollOffset, Buffer* b, int& row, int& col, int& colGo
         // If there is no accessible next line, don't move cursor down.
         // Can't check next line directly because not loaded into view memory yet,
         // so instead check if there is newline at the end of this line.
-        if (linesInView[row]->back() != '\n')
+        if (!linesInView[row].hasNewline)
             return false;
         scrollTextViewUp(scrollOffset, b, true);
     } else {
         // If there is no accessible next line, don't move cursor down
-        if (!linesInView[row + 1].has_value())
+        if (!linesInView[row + 1].exists)
             return false;
         row++;
     }
-    wmove(txtW, row, col = std::min(colGoal, getCleanStrLen(linesInView[row].value())));
+    moveCursorTo(scrollOffset, b, row, col = colForGoal(scrollOffset, row, colGoal));
     return true;
 }
 
@@ -180,85 +472,492 @@ bool moveCursorLeft(int& scrollOffset, Buffer* b, int& row, int& col, int& colGo
     if (col == 0) {
         // If move up success, then go to end
         if (moveCursorUp(scrollOffset, b, row, col, colGoal))
-            wmove(txtW, row, colGoal = col = getCleanStrLen(linesInView[row].value()));
+            moveCursorToCol(scrollOffset, b, row, col, colGoal, linesInView[row].length);
         else
             return false;
     } else
-        wmove(txtW, row, colGoal = --col);
+        moveCursorToCol(scrollOffset, b, row, col, colGoal, columns->get(scrollOffset + row).prev(col));
     return true;
 }
 
 bool moveCursorRight(int& scrollOffset, Buffer* b, int& row, int& col, int& colGoal) {
     // If at end of line and moving right, try to go to start of next line
-    if (col == getCleanStrLen(linesInView[row].value())) {
+    if (col == linesInView[row].length) {
         // If move down success, then go to start
         if (moveCursorDown(scrollOffset, b, row, col, colGoal))
-            wmove(txtW, row, colGoal = col = 0);
+            moveCursorToCol(scrollOffset, b, row, col, colGoal, 0);
         else
             return false;
     } else
-        wmove(txtW, row, colGoal = col = std::min(col + 1, COLS_TXT - 1));
+        moveCursorToCol(scrollOffset, b, row, col, colGoal, columns->get(scrollOffset + row).next(col));
     return true;
 }
 
+// Scrolls the view a page down, keeping the cursor in the same row. If there
+// is less than a page left, scrolls as far as the last line, and if it is
+// already in view, moves the cursor to it.
+void pageDown(int& scrollOffset, Buffer* b, int& row, int& col, int& colGoal) {
+    // Lines of the next page are usually prefetched, so this doesn't read
+    // them from the buffer twice
+    int shift = prefetcher->visitLineSlices(scrollOffset + LINES_TXT, LINES_TXT, 0, sliceWidth(),
+        [](uint, const LineSlice&) {});
+    curs_set(0); // Hide cursor during operations to avoid flickering
+    if (shift > 0) {
+        scrollOffset += shift;
+        drawLineNums(scrollOffset);
+        displayLinesFromBuffer(scrollOffset, 0, b);
+    }
+    if (shift < LINES_TXT) {
+        while (row + 1 < LINES_TXT && linesInView[row + 1].exists)
+            row++;
+    }
+    moveCursorTo(scrollOffset, b, row, col = colForGoal(scrollOffset, row, colGoal));
+    curs_set(1);
+}
+
+// Scrolls the view a page up, keeping the cursor in the same row, or moves
+// the cursor to the first line if it is already in view
+void pageUp(int& scrollOffset, Buffer* b, int& row, int& col, int& colGoal) {
+    int shift = std::min(scrollOffset, LINES_TXT);
+    curs_set(0); // Hide cursor during operations to avoid flickering
+    if (shift > 0) {
+        scrollOffset -= shift;
+        drawLineNums(scrollOffset);
+        displayLinesFromBuffer(scrollOffset, 0, b);
+    }
+    if (shift < LINES_TXT)
+        row = 0;
+    moveCursorTo(scrollOffset, b, row, col = colForGoal(scrollOffset, row, colGoal));
+    curs_set(1);
+}
+
 void delCharAtCursor(int& scrollOffset, Buffer* b, int& row, int& col) {
-    b->delChar(row + scrollOffset, col);
-    wdelch(txtW);
+    // Read before the edit, which changes the mapping
+    const LineColumns& lineColumns = columns->get(row + scrollOffset);
+    bool ascii = lineColumns.isAscii();
+    int length = lineColumns.next(col) - col;
+    if (length > 1)
+        b->deleteRange(row + scrollOffset, col, length, true);
+    else
+        b->delChar(row + scrollOffset, col);
+    // Text after a char that isn't ASCII may not move by one column
+    if (ascii)
+        wdelch(txtW);
     // If cursor is at end of line, deleting linebreak
-    if (col == getCleanStrLen(linesInView[row].value())) {
+    if (col == linesInView[row].length) {
         curs_set(0); // Hide cursor during operations to avoid flickering
         wdeleteln(txtW); // Deletes next row and shifts everything up
-        // Delete entry for current row from linesInView, it will be readded by displayLineFromBuffer
-        linesInView.erase(linesInView.begin() + row);
-        // Delete entry for the deleted row from linesInView
-        linesInView.erase(linesInView.begin() + row);
+        // Shift entries below the deleted row up
+        if (row + 1 < LINES_TXT)
+            linesInView.deleteRow(row + 1);
         // Display updated (concatenated) line
         displayLineFromBuffer(scrollOffset + row, row, b);
         // Display line that scrolled into view from bottom
         displayLineFromBuffer(LINES_TXT - 1 + scrollOffset, LINES_TXT - 1, b);
-        wmove(txtW, row, col);
+        moveCursorTo(scrollOffset, b, row, col);
         curs_set(1);
     } else {
         // Delete char from line in view memory
-        linesInView[row]->erase(col, 1);
+        linesInView[row].length -= length;
+        // A char cut off at the right edge moves into view
+        if (!ascii || linesInView[row].length >= linesInView.leftCol() + COLS_TXT) {
+            displayLineFromBuffer(scrollOffset + row, row, b);
+            moveCursorTo(scrollOffset, b, row, col);
+        } else {
+            highlightRow(row, row + scrollOffset);
+        }
     }
 }
 
 void insertCharAtCursor(int& scrollOffset, Buffer* b, int& row, int& col, int& colGoal, int ch) {
     /// CONSIDER: Splitting up this function for \n and other chars
-    winsch(txtW, ch); // Insert typed character on screen
+    // Text after a char that isn't ASCII may not be where winsch() expects
+    bool ascii = columns->get(row + scrollOffset).isAscii();
+    if (ascii || ch == '\n')
+        winsch(txtW, ch); // Insert typed character on screen
     b->insertChar(ch, row + scrollOffset, col); // Insert character in buffer
     if (ch == '\n') {
         curs_set(0); // Hide cursor during operations to avoid flickering
         // Current line is truncated to linebreak position in view memory
-        linesInView[row] = linesInView[row]->substr(0, col) + '\n';
+        linesInView[row] = {true, col, true};
         // If view has to scroll due to new line
         if (row == LINES_TXT - 1) {
             // Not directly scrolling text view here because it happens automatically
             // when \n char printed by winsch().
             scrollOffset++;
-            // Delete entry from start of table because only tracking visible lines
-            linesInView.erase(linesInView.begin());
+            linesInView.scrollTo(scrollOffset);
             // Explicitly scroll line numbers
             scrollLineNumsUp(scrollOffset);
         } else {
-            wmove(txtW, ++row, col); // Move to next row before inserting new line
+            wmove(txtW, ++row, 0); // Move to next row before inserting new line
             winsertln(txtW); // Add new empty line on screen above cursor, shifting rest down
-            // Delete entry from end of table because only tracking visible lines
-            linesInView.erase(linesInView.end() - 1);
+            // Shift entries down to make room for the new line
+            linesInView.insertRow(row);
         }
         displayLineFromBuffer(scrollOffset + row, row, b); // Text to go in new line
         // Move cursor to start of new line
-        wmove(txtW, row, colGoal = col = 0);
+        moveCursorToCol(scrollOffset, b, row, col, colGoal, 0);
         curs_set(1);
     } else {
         // Insert new character into line in view memory
-        linesInView[row]->insert(linesInView[row]->begin() + col, ch);
+        linesInView[row].length++;
+        if (ascii)
+            highlightRow(row, row + scrollOffset);
+        else
+            displayLineFromBuffer(scrollOffset + row, row, b);
         // Move cursor right when character typed
-        wmove(txtW, row, colGoal = col = std::min(col + 1, COLS_TXT - 1));
+        moveCursorToCol(scrollOffset, b, row, col, colGoal, col + 1);
     }
 }
 
+// Inserts a run of typed or pasted text at the cursor as a single buffer edit.
+// A single char (which takes more than one byte if it isn't ASCII) is typing,
+// and joins the edits typed before it.
+void insertTextAtCursor(int& scrollOffset, Buffer* b, int& row, int& col, int& colGoal, std::string_view text) {
+    int line = row + scrollOffset;
+    bool ascii = columns->get(line).isAscii() && asciiPrefix(text) == text.length();
+    size_t charLength;
+    decodeUtf8(text, 0, &charLength);
+    b->insertText(line, col, text, charLength == text.length());
+    int newlines = std::count(text.begin(), text.end(), '\n');
+    if (newlines == 0) {
+        // Insert text on screen, shifting the rest of the line right
+        if (ascii)
+            winsnstr(txtW, text.data(), text.length());
+        linesInView[row].length += text.length();
+        if (ascii)
+            highlightRow(row, row + scrollOffset);
+        else
+            displayLineFromBuffer(scrollOffset + row, row, b);
+        moveCursorToCol(scrollOffset, b, row, col, colGoal, col + text.length());
+        return;
+    }
+    curs_set(0); // Hide cursor during operations to avoid flickering
+    // Cursor ends up after the inserted text, on the last line it added
+    int cursorLine = line + newlines;
+    col = text.length() - (text.rfind('\n') + 1);
+    if (cursorLine - scrollOffset >= LINES_TXT) {
+        // Scroll so that the cursor is in the bottom row, and redraw everything
+        scrollOffset = cursorLine - (LINES_TXT - 1);
+        drawLineNums(scrollOffset);
+        displayLinesFromBuffer(scrollOffset, 0, b);
+    } else {
+        // Only rows from the edited line downwards change
+        displayLinesFromBuffer(scrollOffset, row, b);
+    }
+    row = cursorLine - scrollOffset;
+    moveCursorToCol(scrollOffset, b, row, col, colGoal, col);
+    curs_set(1);
+}
+
+// Scrolls the view so that a line is in the middle of it, and redraws
+// everything, unless the line is already in view. Returns whether it scrolled.
+bool scrollToLine(int& scrollOffset, Buffer* b, int line) {
+    if (line >= scrollOffset && line < scrollOffset + LINES_TXT)
+        return false;
+    scrollOffset = std::max(0, line - (LINES_TXT) / 2);
+    drawLineNums(scrollOffset);
+    displayLinesFromBuffer(scrollOffset, 0, b);
+    return true;
+}
+
+// Undoes (or redoes) the last edit, moving the cursor to where it was made
+void undoAtCursor(int& scrollOffset, Buffer* b, int& row, int& col, int& colGoal, bool redo) {
+    int line, editCol;
+    if (!(redo ? b->redo(&line, &editCol) : b->undo(&line, &editCol)))
+        return;
+    curs_set(0); // Hide cursor during operations to avoid flickering
+    // Only rows from the edited line downwards change if it was in view
+    if (!scrollToLine(scrollOffset, b, line))
+        displayLinesFromBuffer(scrollOffset, line - scrollOffset, b);
+    row = line - scrollOffset;
+    moveCursorToCol(scrollOffset, b, row, col, colGoal, editCol);
+    curs_set(1);
+}
+
+// Starts saving a snapshot of the buffer in the background
+void startSave(FileSaver& saver, Buffer* b) {
+    if (journal)
+        journalSaveMark = journal->mark();
+    saver.start(b->snapshot(), b->filename);
+    if (remote)
+        remoteSaveMark = remote->snapshotVersion();
+    footerStatus = "Saving";
+    drawFooter(b);
+}
+
+// Shows the progress of a background save in the footer, or its result once
+// it has finished. Starts the queued save, if there is one, after it finishes.
+void updateSaveStatus(FileSaver& saver, Buffer* b, bool& saveQueued) {
+    std::string error;
+    if (saver.finish(&error, false)) {
+        footerStatus = error.empty() ? "Saved" : error;
+        // Edits up to the snapshot are in the file now
+        if (error.empty() && journal) {
+            try {
+                journal->rebase(journalSaveMark);
+            } catch (std::string msg) {
+                footerStatus = msg;
+            }
+        }
+        if (error.empty() && remote)
+            remote->markSaved(remoteSaveMark);
+        if (saveQueued) {
+            saveQueued = false;
+            startSave(saver, b);
+            return;
+        }
+    } else if (saver.busy()) {
+        size_t total = std::max((size_t) 1, saver.totalBytes());
+        footerStatus = "Saving " + std::to_string(saver.bytesWritten() * 100 / total) + "%";
+    } else {
+        return;
+    }
+    drawFooter(b);
+}
+
+// State of find and replace
+struct Search {
+    // Matches of the query typed in search mode, which are highlighted
+    MatchIndex index;
+    // Index of the match the cursor was last moved to
+    size_t current = 0;
+    // Whether to move to the first match from (jumpLine, jumpCol) once
+    // it is found, if the search was left before finding any
+    bool jumpPending = false;
+    uint jumpLine = 0;
+    int jumpCol = 0;
+    // Finds the matches to replace, which (unlike the index's) don't overlap
+    Finder replacer;
+    // Whether to replace all matches once they have all been found
+    bool replacePending = false;
+    std::string replacement;
+
+    Search(Buffer* b) : index(b) {}
+};
+
+// Prompts for text in the footer, starting from `text`. Returns false if
+// the prompt was cancelled.
+bool promptInFooter(Buffer* b, const std::string& label, std::string& text) {
+    int ch = 0;
+    while (ch != '\n') {
+        werase(footW);
+        mvwaddstr(footW, 0, 0, (label + ": " + text).c_str());
+        wrefresh(footW);
+        ch = wgetch(inputW);
+        if (ch == ESCAPE_KEY || ch == ctrl('c')) {
+            drawFooter(b);
+            return false;
+        } else if ((ch == KEY_BACKSPACE || ch == 127) && !text.empty()) {
+            popChar(text);
+        } else if ((ch >= ' ' && ch < 127) || (ch >= 0x80 && ch <= 0xFF)) {
+            text.push_back(ch);
+        }
+    }
+    drawFooter(b);
+    return true;
+}
+
+// Shows which match the cursor is at in the footer
+void showMatchStatus(Search& search, Buffer* b) {
+    const std::vector<Finder::Match>& matches = search.index.getMatches();
+    if (matches.empty())
+        footerStatus = search.index.complete() ? "Not found" : "Searching";
+    else
+        footerStatus = "Match " + std::to_string(std::min(search.current, matches.size() - 1) + 1) + " of "
+            + std::to_string(matches.size()) + (search.index.complete() ? "" : "+");
+    drawFooter(b);
+}
+
+// Moves the cursor to a match
+void moveToMatch(Search& search, size_t i, int& scrollOffset, Buffer* b, int& row, int& col, int& colGoal) {
+    const Finder::Match& match = search.index.getMatches()[i];
+    search.current = i;
+    curs_set(0); // Hide cursor during operations to avoid flickering
+    scrollToLine(scrollOffset, b, match.line);
+    row = match.line - scrollOffset;
+    moveCursorToCol(scrollOffset, b, row, col, colGoal, match.col);
+    curs_set(1);
+}
+
+// Moves the cursor to the first match after it, wrapping around to the
+// first match if the search has found all of them
+void jumpToNextMatch(Search& search, int& scrollOffset, Buffer* b, int& row, int& col, int& colGoal) {
+    const std::vector<Finder::Match>& matches = search.index.getMatches();
+    size_t next = search.index.firstMatchFrom(row + scrollOffset, col + 1);
+    if (next == matches.size() && search.index.complete())
+        next = 0;
+    if (next < matches.size())
+        moveToMatch(search, next, scrollOffset, b, row, col, colGoal);
+    showMatchStatus(search, b);
+}
+
+// Searches as the query is typed in the footer, moving the cursor to the
+// first match from where it was. Enter stays at the match, and Escape
+// returns to where the cursor was.
+void incrementalSearch(Search& search, int& scrollOffset, Buffer* b, int& row, int& col, int& colGoal) {
+    int startScrollOffset = scrollOffset, startRow = row, startCol = col;
+    uint startLine = row + scrollOffset;
+    std::string query;
+    search.index.setQuery(query);
+    highlightView(scrollOffset);
+    bool changed = true;
+    int ch = 0;
+    while (ch != '\n' && ch != ESCAPE_KEY && ch != ctrl('c')) {
+        if (changed) {
+            const std::vector<Finder::Match>& matches = search.index.getMatches();
+            size_t first = search.index.firstMatchFrom(startLine, startCol);
+            if (first == matches.size() && search.index.complete())
+                first = 0;
+            if (first < matches.size())
+                moveToMatch(search, first, scrollOffset, b, row, col, colGoal);
+            highlightView(scrollOffset);
+            showMatchStatus(search, b);
+            if (query.empty())
+                footerStatus.clear();
+            mvwaddstr(footW, 0, 0, ("Search: " + query).c_str());
+            wclrtoeol(footW);
+            if (!footerStatus.empty())
+                mvwaddstr(footW, 0, std::max(0, COLS - (int) footerStatus.length() - 1), footerStatus.c_str());
+            wnoutrefresh(footW);
+            wrefresh(txtW);
+            changed = false;
+        }
+        // Wake up to show matches as the background search finds them
+        wtimeout(inputW, search.index.complete() ? -1 : POLL_MS);
+        ch = wgetch(inputW);
+        if (ch == ERR) {
+            changed = search.index.update();
+        } else if ((ch == KEY_BACKSPACE || ch == 127) && !query.empty()) {
+            popChar(query);
+            search.index.setQuery(query);
+            changed = true;
+        } else if ((ch >= ' ' && ch < 127) || (ch >= 0x80 && ch <= 0xFF)) {
+            query.push_back(ch);
+            search.index.setQuery(query);
+            changed = true;
+        }
+    }
+    wtimeout(inputW, -1);
+    search.jumpPending = ch == '\n' && search.index.getMatches().empty() && !search.index.complete();
+    search.jumpLine = startLine;
+    search.jumpCol = startCol;
+    if (ch != '\n') {
+        search.index.setQuery("");
+        footerStatus.clear();
+        if (scrollOffset != startScrollOffset) {
+            scrollOffset = startScrollOffset;
+            drawLineNums(scrollOffset);
+            displayLinesFromBuffer(scrollOffset, 0, b);
+        }
+        highlightView(scrollOffset);
+        moveCursorToCol(scrollOffset, b, row = startRow, col, colGoal, startCol);
+    }
+    drawFooter(b);
+}
+
+// Collects matches found by background searches, and replaces them once
+// all of the ones to replace have been found
+void updateSearch(Search& search, int& scrollOffset, Buffer* b, int& row, int& col, int& colGoal) {
+    if (search.index.update()) {
+        const std::vector<Finder::Match>& matches = search.index.getMatches();
+        if (search.jumpPending && !matches.empty()) {
+            size_t first = search.index.firstMatchFrom(search.jumpLine, search.jumpCol);
+            if (first < matches.size() || search.index.complete()) {
+                search.jumpPending = false;
+                moveToMatch(search, first < matches.size() ? first : 0, scrollOffset, b, row, col, colGoal);
+            }
+        }
+        highlightView(scrollOffset);
+        showMatchStatus(search, b);
+    }
+    if (search.replacePending && search.replacer.finished()) {
+        search.replacePending = false;
+        std::vector<Finder::Match> matches;
+        search.replacer.copyMatches(0, &matches);
+        search.replacer.replaceAll(b, search.replacement);
+        footerStatus = "Replaced " + std::to_string(matches.size());
+        drawFooter(b);
+        curs_set(0);
+        displayLinesFromBuffer(scrollOffset, 0, b);
+        // Keep the cursor within its (possibly shortened) line
+        moveCursorToCol(scrollOffset, b, row, col, colGoal, std::min(col, linesInView[row].length));
+        curs_set(1);
+    }
+}
+
+// Shows text that changed without being edited here: appended lines,
+// scrolling down to show them if the end of the file was in view, or all
+// of the text replaced, which is read again with the status shown.
+void showOutsideChange(FileFollower::Change change, const std::string& appended, bool continuesLine,
+        const std::string& status, int& scrollOffset, Buffer* b, int& row, int& col, int& colGoal) {
+    int lastLine = b->lineCount() - 1;
+    bool atEnd = lastLine < scrollOffset + LINES_TXT;
+    int line = row + scrollOffset;
+    // The cursor stays on its line, unless it was on the last line
+    bool cursorAtEnd = line == lastLine;
+    if (change == FileFollower::Change::Appended) {
+        b->appendText(appended, continuesLine);
+    } else {
+        b->reload();
+        footerStatus = status;
+        drawFooter(b);
+    }
+    columns->clear();
+    curs_set(0); // Hide cursor during operations to avoid flickering
+    int newLastLine = b->lineCount() - 1;
+    if ((atEnd && newLastLine >= scrollOffset + LINES_TXT) || scrollOffset > newLastLine) {
+        scrollOffset = std::max(0, newLastLine - (LINES_TXT - 1));
+        drawLineNums(scrollOffset);
+        displayLinesFromBuffer(scrollOffset, 0, b);
+    } else if (change == FileFollower::Change::Replaced) {
+        displayLinesFromBuffer(scrollOffset, 0, b);
+    } else if (atEnd) {
+        // Only rows from the old last line downwards change, or the one
+        // before it if the appended text ended that line
+        displayLinesFromBuffer(scrollOffset, std::max(0, lastLine - continuesLine - scrollOffset), b);
+    }
+    if (cursorAtEnd)
+        line = newLastLine;
+    line = std::max(scrollOffset, std::min({line, newLastLine, scrollOffset + LINES_TXT - 1}));
+    row = line - scrollOffset;
+    moveCursorTo(scrollOffset, b, row, col = colForGoal(scrollOffset, row, colGoal));
+    curs_set(1);
+}
+
+// Adds lines appended to the followed file, and reads the whole file again
+// if it was replaced or cut short
+void updateFollow(FileFollower& follower, int& scrollOffset, Buffer* b, int& row, int& col, int& colGoal) {
+    std::string appended;
+    bool continuesLine = false;
+    FileFollower::Change change = follower.poll(&appended, &continuesLine);
+    if (change != FileFollower::Change::None)
+        showOutsideChange(change, appended, continuesLine, "Reloaded", scrollOffset, b, row, col, colGoal);
+}
+
+// Shows edits that other editors made to a buffer held by the server. Edits
+// made here may have moved, so they can't be undone after that.
+void updateRemote(RemoteBuffer& remote, int& scrollOffset, int& row, int& col, int& colGoal) {
+    if (remote.changedElsewhere())
+        showOutsideChange(FileFollower::Change::Replaced, "", false, "Edited elsewhere", scrollOffset, &remote, row, col, colGoal);
+}
+
+// Whether a key is one that only moves around or searches, which are the
+// only keys allowed in read-only buffers
+bool isViewKey(int ch) {
+    switch (ch) {
+        case KEY_LEFT: case KEY_RIGHT: case KEY_UP: case KEY_DOWN: case KEY_PPAGE: case KEY_NPAGE:
+        case KEY_HOME: case KEY_END: case KEY_RESIZE: case ctrl('f'): case ctrl('g'): case ctrl('t'):
+            return true;
+    }
+    return false;
+}
+
+// Whether a key is text to insert, rather than a command or special key
+bool isTextInput(int ch) {
+    return ch == '\n' || ch == '\t' || (ch >= ' ' && ch < KEY_MIN && ch != 127);
+}
+
 char* getCmdOption(char** begin, char** end, const std::string& option)
 {
     char** itr = std::find(begin, end, option);
@@ -277,11 +976,23 @@ bool cmdOptionExists(char** begin, char** end, const std::string& option)
 int main(int argc, char* argv[]) {
     // Parsing command-line arguments
     if (argc < 2) {
-        std::cout << "tekst <filename> [-d] [-b BufferType]" << std::endl;
+        std::cout << "tekst <filename> [-d] [-f] [-l] [-b BufferType] [-u UndoMemoryMB] [-m PageMemoryMB]" << std::endl;
+        std::cout << "tekst -s (runs a server holding files for editors to open)" << std::endl;
+        return 0;
+    }
+    if (std::string(argv[1]) == "-s") {
+        try {
+            EditorServer server(defaultSocketPath());
+            std::cout << "Listening at " << defaultSocketPath() << std::endl;
+            server.run();
+        } catch (std::string msg) {
+            std::cout << msg << std::endl;
+            return 1;
+        }
         return 0;
     }
     char* filename = argv[1];
-    debugLog << "Opening file: " << filename << std::endl;
+    trace("Opening file: %s", filename);
     bool DEBUG = cmdOptionExists(argv, argv + argc, "-d");
     BufferType bufferType;
     char* bufferTypeStr = getCmdOption(argv, argv + argc, "-b");
@@ -291,24 +1002,66 @@ int main(int argc, char* argv[]) {
         bufferType = BufferType::ArrayBufferType;
 
     std::unique_ptr<Buffer> b; // Owned reference to text buffer
-    debugLog << "Buffer type: " << Buffer::bufferTypeToString(bufferType) << std::endl;
+    // The file is opened from a server if one is running, unless asked to
+    // open it here (with -l). A followed file is always opened here, as it
+    // changes under the buffer.
+    bool follow = cmdOptionExists(argv, argv + argc, "-f");
+    bool local = cmdOptionExists(argv, argv + argc, "-l") || follow;
+    trace("Buffer type: %s", Buffer::bufferTypeToString(bufferType).c_str());
     try {
-        b = Buffer::createBuffer(bufferType, filename);
+        std::unique_ptr<RemoteBuffer> remoteBuffer;
+        if (!local)
+            remoteBuffer = RemoteBuffer::connect(bufferType, filename);
+        remote = remoteBuffer.get();
+        if (remoteBuffer)
+            b = std::move(remoteBuffer);
+        else
+            b = Buffer::createBuffer(bufferType, filename, follow);
     } catch (std::string msg) {
         if (DEBUG)
-            std::cout << debugLog.str();
+            dumpTrace(std::cout);
         std::cout << msg << std::endl;
         return 0;
     }
+    char* undoMemoryStr = getCmdOption(argv, argv + argc, "-u");
+    if (undoMemoryStr)
+        b->history.setMaxBytes((size_t) std::max(0, atoi(undoMemoryStr)) << 20);
+    char* pageMemoryStr = getCmdOption(argv, argv + argc, "-m");
+    PagedBuffer* paged = dynamic_cast<PagedBuffer*>(b.get());
+    if (pageMemoryStr && paged)
+        paged->setMemoryBudget((size_t) std::max(0, atoi(pageMemoryStr)) << 20);
+    // Watches for lines appended to the file, like tail -f
+    std::unique_ptr<FileFollower> follower;
+    if (follow)
+        follower = std::make_unique<FileFollower>(filename);
+    // Keeps unsaved edits in a journal next to the file, and brings back the
+    // ones left there if the editor didn't exit cleanly last time. A followed
+    // file changes under the buffer, so its edits couldn't be replayed. The
+    // server keeps the edits of a buffer it holds when an editor crashes.
+    std::unique_ptr<EditJournal> editJournal;
+    if (!follower && !remote && !b->isReadOnly()) {
+        editJournal = std::make_unique<EditJournal>(filename);
+        try {
+            size_t replayed = editJournal->start(b.get());
+            if (replayed > 0)
+                footerStatus = "Recovered " + std::to_string(replayed) + (replayed == 1 ? " edit" : " edits");
+            journal = editJournal.get();
+        } catch (std::string msg) {
+            footerStatus = msg;
+            editJournal.reset();
+        }
+    }
+    if (remote && remote->recoveredEdits())
+        footerStatus = "Recovered unsaved edits";
 
-    // Setup curses mode
+    // Setup curses mode. Text is shown as UTF-8 if the terminal's locale is.
+    setlocale(LC_ALL, "");
     initscr();
     raw();
     noecho();
 
     // Initialize text edit region window
     txtW = newwin(LINES_TXT, COLS_TXT, 1, 4);
-    keypad(txtW, TRUE);
     // Enable vertical scrolling
     scrollok(txtW, TRUE);
 
@@ -324,6 +1077,18 @@ int main(int argc, char* argv[]) {
     scrollok(lineNumW, TRUE);
     wattron(lineNumW, A_DIM);
 
+    // Initialize input window. Its one (blank) cell is painted once now,
+    // before the header is drawn over it, and never again.
+    inputW = newwin(1, 1, 0, 0);
+    keypad(inputW, TRUE);
+    wnoutrefresh(inputW);
+
+    // Holds the buffer from here on, except while waiting for keys
+    LinePrefetcher linePrefetcher(b.get());
+    prefetcher = &linePrefetcher;
+    ColumnCache columnCache(b.get());
+    columns = &columnCache;
+
     int scrollOffset = 0; // Amount text window was scrolled by (positive = downwards)
     int row = 0, col = 0; // Position of cursor in text window
     // Which column cursors wants to be on (for persistent
@@ -338,65 +1103,207 @@ int main(int argc, char* argv[]) {
 
     // Whether program is terminated early due to an error
     bool err = false;
+    // Text typed ahead of the editor, reused between keys
+    std::string typeahead;
+    // Writes saves in the background. A save requested while one is
+    // running is queued, and starts once the running one finishes.
+    FileSaver saver;
+    bool saveQueued = false;
+    Search search(b.get());
+    matchIndex = &search.index;
+    // Matches found for a replace are out of date after an edit
+    b->addEditListener([&search](uint, uint, uint) {
+        if (search.replacePending) {
+            search.replacer.cancel();
+            search.replacePending = false;
+            footerStatus = "Replace cancelled";
+        }
+    });
+
+    // Gets the next key, only repainting once there is no more input
+    // waiting. While saving, searching or following the file, wakes up
+    // regularly to show progress.
+    auto nextKey = [&]() {
+        nodelay(inputW, TRUE);
+        int key = wgetch(inputW);
+        while (key == ERR) {
+            updateSaveStatus(saver, b.get(), saveQueued);
+            updateSearch(search, scrollOffset, b.get(), row, col, colGoal);
+            if (follower)
+                updateFollow(*follower, scrollOffset, b.get(), row, col, colGoal);
+            if (remote)
+                updateRemote(*remote, scrollOffset, row, col, colGoal);
+            if (showStats)
+                drawFooter(b.get());
+            {
+                TraceTimer timer(TraceOp::Repaint);
+                wrefresh(txtW);
+            }
+            wtimeout(inputW, follower || remote || saver.busy() || search.replacePending || !search.index.complete() ? POLL_MS : -1);
+            // Lines around the view are read in the background while waiting
+            prefetcher->setView(scrollOffset, LINES_TXT, 0, sliceWidth());
+            prefetcher->release();
+            key = wgetch(inputW);
+            prefetcher->acquire();
+        }
+        nodelay(inputW, FALSE);
+        return key;
+    };
 
-    // Input loop
-    int ch = wgetch(txtW);
-    while (ch != ctrl('c') && !err) { // Exit code
-        switch (ch) {
-            /// TODO: Add page up/down key cases
-            case KEY_BACKSPACE:
-                // If able to move left (or up), do it and delete char
-                if (moveCursorLeft(scrollOffset, b.get(), row, col, colGoal))
+    // Input loop. All keys that are already waiting (a paste, key repeat or
+    // a slow connection catching up) are handled before repainting once.
+    // The connection to a server can be lost while editing.
+    std::string errorMessage;
+    try {
+        int ch = nextKey();
+        while (ch != ctrl('c') && !err) { // Exit code
+            auto keyStart = std::chrono::steady_clock::now();
+            // Anything but typing or deleting ends the current run of edits,
+            // so that it is undone separately from the next one
+            if (!isTextInput(ch) && ch != KEY_BACKSPACE && ch != KEY_DC)
+                b->history.seal();
+            if (b->isReadOnly() && !isViewKey(ch)) {
+                footerStatus = "Read only";
+                drawFooter(b.get());
+            } else switch (ch) {
+                case KEY_BACKSPACE:
+                    // If able to move left (or up), do it and delete char
+                    if (moveCursorLeft(scrollOffset, b.get(), row, col, colGoal))
+                        delCharAtCursor(scrollOffset, b.get(), row, col);
+                    break;
+                case KEY_DC:
                     delCharAtCursor(scrollOffset, b.get(), row, col);
-                break;
-            case KEY_DC:
-                delCharAtCursor(scrollOffset, b.get(), row, col);
-                break;
-            case KEY_LEFT:
-                moveCursorLeft(scrollOffset, b.get(), row, col, colGoal);
-                break;
-            case KEY_RIGHT:
-                moveCursorRight(scrollOffset, b.get(), row, col, colGoal);
-                break;
-            case KEY_UP:
-                moveCursorUp(scrollOffset, b.get(), row, col, colGoal);
-                break;
-            case KEY_DOWN:
-                moveCursorDown(scrollOffset, b.get(), row, col, colGoal);
-                break;
-            case KEY_HOME:
-                wmove(txtW, row, colGoal = col = 0);
-                break;
-            case KEY_END:
-                wmove(txtW, row, colGoal = col = getCleanStrLen(linesInView[row].value()));
-                break;
-            case ctrl('s'):
-                try {
-                    b->save();
-                } catch (std::string msg) {
-                    err = true;
-                    debugLog << msg << std::endl;
+                    break;
+                case KEY_LEFT:
+                    moveCursorLeft(scrollOffset, b.get(), row, col, colGoal);
+                    break;
+                case KEY_RIGHT:
+                    moveCursorRight(scrollOffset, b.get(), row, col, colGoal);
+                    break;
+                case KEY_UP:
+                    moveCursorUp(scrollOffset, b.get(), row, col, colGoal);
+                    break;
+                case KEY_DOWN:
+                    moveCursorDown(scrollOffset, b.get(), row, col, colGoal);
+                    break;
+                case KEY_PPAGE:
+                    pageUp(scrollOffset, b.get(), row, col, colGoal);
+                    break;
+                case KEY_NPAGE:
+                    pageDown(scrollOffset, b.get(), row, col, colGoal);
+                    break;
+                case KEY_HOME:
+                    moveCursorToCol(scrollOffset, b.get(), row, col, colGoal, 0);
+                    break;
+                case KEY_END:
+                    moveCursorToCol(scrollOffset, b.get(), row, col, colGoal, linesInView[row].length);
+                    break;
+                case ctrl('s'):
+                    // Saved from a snapshot in the background, so editing can continue
+                    if (saver.busy())
+                        saveQueued = true;
+                    else
+                        startSave(saver, b.get());
+                    break;
+                case ctrl('z'):
+                    undoAtCursor(scrollOffset, b.get(), row, col, colGoal, false);
+                    break;
+                case ctrl('y'):
+                    undoAtCursor(scrollOffset, b.get(), row, col, colGoal, true);
+                    break;
+                case KEY_RESIZE:
+                    handleResize(b.get(), scrollOffset, row);
+                    moveCursorTo(scrollOffset, b.get(), row, col);
+                    break;
+                case ctrl('t'):
+                    showStats = !showStats;
+                    drawFooter(b.get());
+                    break;
+                case ctrl('f'):
+                    incrementalSearch(search, scrollOffset, b.get(), row, col, colGoal);
+                    break;
+                case ctrl('g'):
+                    // Next match of the last search
+                    if (!search.index.getQuery().empty())
+                        jumpToNextMatch(search, scrollOffset, b.get(), row, col, colGoal);
+                    break;
+                case ctrl('r'): {
+                    std::string query = search.index.getQuery();
+                    if (!promptInFooter(b.get(), "Replace", query) || query.empty()
+                        || !promptInFooter(b.get(), "Replace " + query + " with", search.replacement))
+                        break;
+                    search.replacer.start(b->snapshot(), query);
+                    search.replacePending = true;
+                    footerStatus = "Replacing";
+                    drawFooter(b.get());
+                    updateSearch(search, scrollOffset, b.get(), row, col, colGoal);
+                    break;
                 }
-                break;
-            case KEY_RESIZE:
-                handleResize(b.get(), scrollOffset);
-                wmove(txtW, row, col);
-                break;
-            default:
-                insertCharAtCursor(scrollOffset, b.get(), row, col, colGoal, ch);
+                default:
+                    if (!isTextInput(ch)) {
+                        insertCharAtCursor(scrollOffset, b.get(), row, col, colGoal, ch);
+                        break;
+                    }
+                    // Gather text that is already waiting (e.g. a paste), so it
+                    // goes into the buffer as one edit instead of a char at a time
+                    typeahead.assign(1, (char) ch);
+                    nodelay(inputW, TRUE);
+                    while ((ch = wgetch(inputW)) != ERR && isTextInput(ch))
+                        typeahead.push_back(ch);
+                    nodelay(inputW, FALSE);
+                    // The rest of a char that isn't ASCII can be on its way still
+                    while (ch == ERR && endsMidChar(typeahead) && (ch = wgetch(inputW)) != ERR && isTextInput(ch)) {
+                        typeahead.push_back(ch);
+                        ch = ERR;
+                    }
+                    // First key that wasn't text is handled on the next iteration
+                    if (ch != ERR)
+                        ungetch(ch);
+                    if (typeahead.length() == 1 && (unsigned char) typeahead[0] < 0x80)
+                        insertCharAtCursor(scrollOffset, b.get(), row, col, colGoal, typeahead[0]);
+                    else
+                        insertTextAtCursor(scrollOffset, b.get(), row, col, colGoal, typeahead);
+            }
+            recordLatency(TraceOp::Key, std::chrono::steady_clock::now() - keyStart);
+            ch = nextKey();
         }
-        wrefresh(txtW);
-        ch = wgetch(txtW);
+    } catch (std::string msg) {
+        errorMessage = msg;
+        err = true;
     }
 
+    // Let a save in progress (and a queued one) finish before exiting. The
+    // queued one can't be taken from a server that went away.
+    std::string saveError;
+    if (saver.finish(&saveError, true) && saveQueued && errorMessage.empty()) {
+        saver.start(b->snapshot(), b->filename);
+        saver.finish(&saveError, true);
+    }
+    if (!saveError.empty())
+        err = true;
+    // The journal is only left behind if edits may not have been saved, and
+    // likewise the server only keeps them if the file isn't closed
+    if (err && editJournal)
+        editJournal->keep();
+    if (!err && remote)
+        remote->close();
+
     delwin(headW);
     delwin(footW);
     delwin(txtW);
     delwin(lineNumW);
+    delwin(inputW);
 
     endwin();
-    if (DEBUG || err)
-        std::cout << debugLog.str();
+    if (!errorMessage.empty())
+        std::cout << errorMessage << std::endl;
+    if (err)
+        dumpTrace(std::cout);
+    if (DEBUG) {
+        std::ofstream traceFile(TRACE_FILE);
+        dumpTrace(traceFile);
+        std::cout << "Trace written to " << TRACE_FILE << std::endl;
+    }
 
     return 0;
 }
\ No newline at end of file